@@ -9,6 +9,10 @@
 
 #include "nanoalsa.h"
 
+#ifdef NANOALSA_TRACE
+void (*pcm_trace_hook)(int event, int fd, long a, long b);
+#endif
+
 // Hardware parameters manipulation
 // ========================================================================
 
@@ -223,6 +227,9 @@ pcm_sync(int fd, struct pcm_sync *sync, unsigned int flags)
 	sync->control = tmp.c.control;
 	sync->status  = tmp.s.status;
 
+	PCM_TRACE(PCM_TRACE_SYNC, fd, sync->status.hw_ptr, sync->control.appl_ptr);
+	PCM_TRACE(PCM_TRACE_STATE, fd, sync->status.state, 0);
+
 	return 0;
 }
 
@@ -240,6 +247,158 @@ pcm_action_timestamp(int fd, struct timespec *ts)
 	return 0;
 }
 
+// Timer-scheduled wakeups
+// ========================================================================
+
+#include <errno.h>       // errno, EINVAL
+#include <sys/timerfd.h> // timerfd_create(), timerfd_settime()
+#include <unistd.h>      // read(), close()
+
+#define NSEC_PER_SEC 1000000000L
+
+static inline long
+timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * NSEC_PER_SEC + a->tv_nsec - b->tv_nsec;
+}
+
+static inline void
+timespec_add_ns(struct timespec *ts, long ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec--;
+		ts->tv_nsec += NSEC_PER_SEC;
+	}
+}
+
+int
+pcm_timer_init(struct pcm_timer *t, unsigned int rate)
+{
+	memset(t, 0, sizeof(*t));
+	if (!rate) {
+		t->fd = -1;
+		errno = EINVAL;
+		return -1;
+	}
+	t->rate = rate;
+
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	return t->fd == -1 ? -1 : 0;
+}
+
+// Rate is measured over intervals of at least this length, so that the
+// granularity of hw_ptr (DMA bursts) does not disturb the measurement.
+#define TIMER_RATE_INTERVAL (NSEC_PER_SEC / 4)
+
+static void
+timer_update_rate(struct pcm_timer *t, struct pcm_sync *sync)
+{
+	struct timespec *tstamp = &sync->status.tstamp;
+	long elapsed;
+
+	// timestamp is zero when it is not enabled (see PCM_TSTAMP_TYPE)
+	if (!tstamp->tv_sec && !tstamp->tv_nsec)
+		return;
+
+	elapsed = timespec_diff_ns(tstamp, &t->tstamp);
+	if (!t->tstamp.tv_sec || elapsed < 0 || sync->status.hw_ptr < t->hw_ptr) {
+		// first measurement or stream restarted
+		t->hw_ptr = sync->status.hw_ptr;
+		t->tstamp = *tstamp;
+		return;
+	}
+	if (elapsed < TIMER_RATE_INTERVAL)
+		return;
+
+	// exponential moving average (weight 1/8)
+	t->rate += ((sync->status.hw_ptr - t->hw_ptr) * (double) NSEC_PER_SEC /
+	            elapsed - t->rate) / 8;
+	t->hw_ptr = sync->status.hw_ptr;
+	t->tstamp = *tstamp;
+}
+
+// Update lateness statistics and the margin. Margin covers mean lateness
+// plus four times its mean deviation.
+static void
+timer_update_margin(struct pcm_timer *t, long late)
+{
+	long deviation = late - t->lateness;
+
+	t->lateness  += deviation / 8;
+	t->deviation += ((deviation < 0 ? -deviation : deviation) -
+	                 t->deviation) / 8;
+
+	t->margin = t->lateness + 4 * t->deviation;
+	if (t->margin < 0)
+		t->margin = 0;
+}
+
+// Sleep until hardware position is predicted to reach hw_pos. On return,
+// `sync` has the position after waking up. Return immediately if the
+// stream is not running or hw_pos has already been reached.
+int
+pcm_timer_wait(int fd, struct pcm_timer *t, unsigned long hw_pos,
+               struct pcm_sync *sync)
+{
+	struct itimerspec its = {0};
+	struct timespec now, target;
+	uint64_t expirations;
+	long remaining, sleep;
+
+	// positions are converted to time with the rate
+	if (!(t->rate > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pcm_sync(fd, sync, PCM_REQUEST_HW) == -1)
+		return -1;
+	timer_update_rate(t, sync);
+
+	remaining = hw_pos - sync->status.hw_ptr;
+	if (sync->status.state != PCM_STATE_RUNNING || remaining <= 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	target = now;
+	timespec_add_ns(&target, remaining * NSEC_PER_SEC / t->rate);
+
+	sleep = timespec_diff_ns(&target, &now) - t->margin;
+	if (sleep <= 0)
+		return 0;
+
+	its.it_value = now;
+	timespec_add_ns(&its.it_value, sleep);
+	PCM_TRACE(PCM_TRACE_SLEEP, fd, hw_pos, 0);
+	if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL) == -1 ||
+	    read(t->fd, &expirations, sizeof(expirations)) == -1) {
+		PCM_TRACE(PCM_TRACE_END, fd, -1, 0);
+		return -1;
+	}
+	PCM_TRACE(PCM_TRACE_END, fd, 0, 0);
+
+	if (pcm_sync(fd, sync, PCM_REQUEST_HW) == -1)
+		return -1;
+	timer_update_rate(t, sync);
+
+	// Lateness is how far the hardware went beyond hw_pos, converted
+	// to time. Early wakeups (negative lateness) are expected due to
+	// the margin, thus margin is added back.
+	remaining = hw_pos - sync->status.hw_ptr;
+	timer_update_margin(t, t->margin - remaining * NSEC_PER_SEC / t->rate);
+
+	return 0;
+}
+
+void
+pcm_timer_close(struct pcm_timer *t)
+{
+	close(t->fd);
+}
+
 // Helpers for setting up the PCM device
 // ========================================================================
 
@@ -337,18 +496,19 @@ pcm_params_refine(int fd, pcm_params_t *params)
 	return ioctl(fd, SNDRV_PCM_IOCTL_HW_REFINE, &params->hw_params);
 }
 
-int
-pcm_params_setup(int fd, pcm_params_t *params)
+// Software parameters that default to hardware ones (after HW_PARAMS)
+static void
+sw_params_defaults(pcm_params_t *params)
 {
-	// send hardware parameters to ALSA in kernel
-	if (ioctl(fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params->hw_params) == -1)
-		return -1;
-
 	if (!pcm_get(params, PCM_AVAIL_MIN, 0))
 		pcm_set(params, PCM_AVAIL_MIN, pcm_get(params, PCM_PERIOD_SIZE, 0));
 	if (!pcm_get(params, PCM_XRUN_THRESHOLD, 0))
 		pcm_set(params, PCM_XRUN_THRESHOLD, pcm_get(params, PCM_BUFFER_SIZE, 0));
+}
 
+static int
+sw_params_send(int fd, pcm_params_t *params)
+{
 	// must use TTSTAMP ioctl before 2.0.12 protocol
 #ifdef SNDRV_PCM_IOCTL_TTSTAMP
 	if (ioctl(fd, SNDRV_PCM_IOCTL_TTSTAMP, &params->sw_params.tstamp_type) == -1)
@@ -356,12 +516,250 @@ pcm_params_setup(int fd, pcm_params_t *params)
 #endif
 
 	// send software parameters to ALSA in kernel
-	if (ioctl(fd, SNDRV_PCM_IOCTL_SW_PARAMS, &params->sw_params) == -1)
+	return ioctl(fd, SNDRV_PCM_IOCTL_SW_PARAMS, &params->sw_params);
+}
+
+static int
+params_setup(int fd, pcm_params_t *params)
+{
+	// send hardware parameters to ALSA in kernel
+	if (ioctl(fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params->hw_params) == -1)
+		return -1;
+
+	sw_params_defaults(params);
+
+	if (sw_params_send(fd, params) == -1)
 		return -1;
 
 	return ioctl(fd, SNDRV_PCM_IOCTL_PREPARE);
 }
 
+int
+pcm_params_setup(int fd, pcm_params_t *params)
+{
+	int ret;
+
+	PCM_TRACE(PCM_TRACE_SETUP, fd, 0, 0);
+	ret = params_setup(fd, params);
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+
+	return ret;
+}
+
+#define MASK_WORDS (sizeof(struct snd_mask) / sizeof(uint32_t))
+
+// Whether the configuration chosen by HW_PARAMS (`chosen`) is one of
+// those allowed by `request`
+static int
+hw_params_fit(struct snd_pcm_hw_params *chosen,
+              struct snd_pcm_hw_params *request)
+{
+	struct snd_interval *c, *r;
+	int i, j, masks = SNDRV_PCM_HW_PARAM_LAST_MASK -
+	                  SNDRV_PCM_HW_PARAM_FIRST_MASK;
+
+	if (chosen->flags != request->flags)
+		return 0;
+
+	for (i = 0; i <= masks; i++) {
+		for (j = 0; j < (int) MASK_WORDS; j++) {
+			if (chosen->masks[i].bits[j] & ~request->masks[i].bits[j])
+				return 0;
+		}
+	}
+
+	for (i = 0; i <= INTERVAL_COUNT; i++) {
+		c = &chosen->intervals[i];
+		r = &request->intervals[i];
+		if (c->min + c->openmin < r->min + r->openmin ||
+		    c->max - c->openmax > r->max - r->openmax)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+sw_params_equal(pcm_sw_params_t *a, pcm_sw_params_t *b)
+{
+	return a->tstamp_mode       == b->tstamp_mode &&
+	       a->tstamp_type       == b->tstamp_type &&
+	       a->period_step       == b->period_step &&
+	       a->sleep_min         == b->sleep_min &&
+	       a->avail_min         == b->avail_min &&
+	       a->xfer_align        == b->xfer_align &&
+	       a->start_threshold   == b->start_threshold &&
+	       a->stop_threshold    == b->stop_threshold &&
+	       a->silence_threshold == b->silence_threshold &&
+	       a->silence_size      == b->silence_size;
+}
+
+static int
+reconfigure(int fd, pcm_params_t *from, pcm_params_t *to)
+{
+	int hw_changed = !hw_params_fit(&from->hw_params, &to->hw_params);
+
+	if (pcm_stop(fd) == -1)
+		return -1;
+
+	if (hw_changed) {
+		if (ioctl(fd, SNDRV_PCM_IOCTL_HW_FREE) == -1 ||
+		    ioctl(fd, SNDRV_PCM_IOCTL_HW_PARAMS, &to->hw_params) == -1)
+			return -1;
+	} else {
+		// the configuration in use is kept, and so is its buffer
+		to->hw_params = from->hw_params;
+	}
+
+	sw_params_defaults(to);
+
+	// HW_PARAMS resets software parameters in the kernel
+	if ((hw_changed || !sw_params_equal(&from->sw_params, &to->sw_params)) &&
+	    sw_params_send(fd, to) == -1)
+		return -1;
+
+	return pcm_prepare(fd);
+}
+
+int
+pcm_reconfigure(int fd, pcm_params_t *from, pcm_params_t *to,
+                long *latency_ns)
+{
+	struct timespec start, end;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	PCM_TRACE(PCM_TRACE_SETUP, fd, 1, 0);
+	ret = reconfigure(fd, from, to);
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (latency_ns)
+		*latency_ns = timespec_diff_ns(&end, &start);
+
+	return ret;
+}
+
+// Buffer pool
+// ========================================================================
+
+#include <sys/mman.h> // mmap(), mlock()
+#include <unistd.h>   // sysconf()
+
+#define POOL_ALIGN 64
+#define POOL_END   0xffffffffU
+
+#define HUGEPAGE_SIZE (2UL << 20)
+
+static inline size_t
+round_up(size_t size, size_t align)
+{
+	return (size + align - 1) / align * align;
+}
+
+int
+pcm_pool_init(struct pcm_pool *pool, pcm_params_t *params, pcm_param_t size,
+              unsigned int count, int flags)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE), bytes;
+	void *memory = MAP_FAILED;
+	unsigned int i;
+
+	memset(pool, 0, sizeof(*pool));
+	if (!count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pool->count = count;
+	pool->buffer_size = round_up(pcm_get(params, size, 0),
+	                             flags & PCM_POOL_PAGE_ALIGN ? page_size
+	                                                         : POOL_ALIGN);
+	if (!pool->buffer_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// links of free list are after the buffers
+	bytes = pool->buffer_size * count + sizeof(*pool->next) * count;
+
+	// MAP_POPULATE prefaults pages
+	if (flags & PCM_POOL_HUGEPAGES) {
+		pool->memory_size = round_up(bytes, HUGEPAGE_SIZE);
+		memory = mmap(NULL, pool->memory_size, PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE |
+		              MAP_HUGETLB, -1, 0);
+	}
+	if (memory == MAP_FAILED) {
+		pool->memory_size = round_up(bytes, page_size);
+		memory = mmap(NULL, pool->memory_size, PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	}
+	if (memory == MAP_FAILED)
+		return -1;
+
+	if (flags & PCM_POOL_LOCK && mlock(memory, pool->memory_size) == -1) {
+		munmap(memory, pool->memory_size);
+		return -1;
+	}
+
+	pool->memory = memory;
+	pool->next = (unsigned int*) (pool->memory + pool->buffer_size * count);
+	for (i = 0; i < count; i++)
+		pool->next[i] = i + 1 < count ? i + 1 : POOL_END;
+	pool->head = 0; // tag 0, index 0
+
+	return 0;
+}
+
+// Free list is a lock-free stack. The tag in the upper half of head is
+// incremented on each change, so a compare-and-swap fails if the head
+// was taken and put back in between (ABA problem). A link may be read
+// by one thread while another writes it (the CAS then fails), so links
+// are accessed atomically too.
+void*
+pcm_pool_get(struct pcm_pool *pool)
+{
+	uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE), new;
+	unsigned int index;
+
+	do {
+		index = head & POOL_END;
+		if (index == POOL_END)
+			return NULL;
+		new = ((head >> 32) + 1) << 32 |
+		      __atomic_load_n(&pool->next[index], __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&pool->head, &head, new, 1,
+	                                      __ATOMIC_ACQ_REL,
+	                                      __ATOMIC_ACQUIRE));
+
+	return pool->memory + pool->buffer_size * index;
+}
+
+void
+pcm_pool_put(struct pcm_pool *pool, void *buffer)
+{
+	unsigned int index = ((char*) buffer - pool->memory) / pool->buffer_size;
+	uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE), new;
+
+	do {
+		__atomic_store_n(&pool->next[index], head & POOL_END,
+		                 __ATOMIC_RELAXED);
+		new = ((head >> 32) + 1) << 32 | index;
+	} while (!__atomic_compare_exchange_n(&pool->head, &head, new, 1,
+	                                      __ATOMIC_ACQ_REL,
+	                                      __ATOMIC_ACQUIRE));
+}
+
+void
+pcm_pool_destroy(struct pcm_pool *pool)
+{
+	if (pool->memory)
+		munmap(pool->memory, pool->memory_size);
+	pool->memory = NULL;
+}
+
 // Helper for opening Linux PCM device
 // ========================================================================
 
@@ -385,3 +783,226 @@ pcm_open(int card, int device, int flags)
 
 	return open(path, O_RDWR | (flags & PCM_NONBLOCK ? O_NONBLOCK : 0));
 }
+
+// Late updates
+// ========================================================================
+
+void
+pcm_late_observe(struct pcm_late *late, struct pcm_sync *sync)
+{
+	unsigned long advance = sync->status.hw_ptr - late->hw_ptr;
+
+	// The first observation has nothing to measure the advance from,
+	// and hw_ptr goes back to zero when the stream is prepared again
+	if (late->seeded && sync->status.hw_ptr > late->hw_ptr &&
+	    (!late->step || advance < late->step))
+		late->step = advance;
+
+	late->hw_ptr = sync->status.hw_ptr;
+	late->seeded = 1;
+}
+
+// Rewind application position to `margin` frames plus the DMA granularity
+// ahead of hardware position. The caller renders again from the position
+// returned in `appl_ptr`, which is also the position of the next write.
+//
+// Return the frames rewound (zero if there was nothing to rewind), or -1.
+int
+pcm_late_rewind(int fd, struct pcm_late *late, unsigned long margin,
+                unsigned long *appl_ptr)
+{
+	struct pcm_sync sync;
+	unsigned long queued, keep;
+	int moved;
+
+	if (pcm_sync(fd, &sync, PCM_REQUEST_HW) == -1)
+		return -1;
+	pcm_late_observe(late, &sync);
+
+	queued = sync.control.appl_ptr - sync.status.hw_ptr;
+	keep = margin + late->step;
+
+	*appl_ptr = sync.control.appl_ptr;
+	if (sync.status.state != PCM_STATE_RUNNING || queued <= keep)
+		return 0;
+
+	moved = pcm_move_app_pos(fd, -(int) (queued - keep));
+	if (moved == -1)
+		return -1;
+
+	*appl_ptr += moved;
+	return -moved;
+}
+
+// Scheduled start
+// ========================================================================
+
+// the last part of the wait is spun, as sleeping wakes up late
+#define START_SPIN_NS 200000L
+
+static int
+write_silence(int fd, pcm_params_t *params, long frames)
+{
+	unsigned char buf[4096];
+	int frame_bytes = pcm_get(params, PCM_FRAME_BITS, 0) / 8;
+	int sample_bytes = pcm_get(params, PCM_SAMPLE_BITS, 0) / 8;
+	int chunk = sizeof(buf) / frame_bytes, msb = -1, i, ret;
+
+	// silence of unsigned formats is the middle value
+	if (pcm_get(params, PCM_FORMAT, PCM_FORMAT_U8) ||
+	    pcm_get(params, PCM_FORMAT, PCM_FORMAT_U16_BE) ||
+	    pcm_get(params, PCM_FORMAT, PCM_FORMAT_U32_BE))
+		msb = 0;
+	else if (pcm_get(params, PCM_FORMAT, PCM_FORMAT_U16_LE) ||
+	         pcm_get(params, PCM_FORMAT, PCM_FORMAT_U32_LE))
+		msb = sample_bytes - 1;
+
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; msb != -1 && i < chunk * frame_bytes; i += sample_bytes)
+		buf[i + msb] = 0x80;
+
+	while (frames > 0) {
+		ret = pcm_write(fd, buf, frames < chunk ? frames : chunk);
+		if (ret == -1)
+			return -1;
+		frames -= ret;
+	}
+
+	return 0;
+}
+
+static clockid_t
+tstamp_clock(pcm_params_t *params)
+{
+	switch (pcm_get(params, PCM_TSTAMP_TYPE, 0)) {
+	case PCM_CLOCK_MONOTONIC:     return CLOCK_MONOTONIC;
+	case PCM_CLOCK_MONOTONIC_RAW: return CLOCK_MONOTONIC_RAW;
+	default:                      return CLOCK_REALTIME;
+	}
+}
+
+// Sleep until `wake` on `clock`. CLOCK_MONOTONIC_RAW can not be slept
+// on, so its deadline is converted to CLOCK_MONOTONIC (the spin after
+// the sleep absorbs the small difference of rate between them).
+static int
+sleep_until(clockid_t clock, const struct timespec *wake)
+{
+	struct timespec deadline = *wake, now;
+	int err;
+
+	if (clock == CLOCK_MONOTONIC_RAW) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		timespec_add_ns(&deadline, timespec_diff_ns(wake, &now));
+		clock = CLOCK_MONOTONIC;
+	}
+
+	while ((err = clock_nanosleep(clock, TIMER_ABSTIME, &deadline,
+	                              NULL)) == EINTR)
+		;
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+start_at(int fd, pcm_params_t *params, const struct timespec *target,
+         unsigned int flags, struct pcm_start_result *r)
+{
+	clockid_t clock = tstamp_clock(params);
+	unsigned int rate = pcm_get(params, PCM_RATE, 0);
+	long preroll = pcm_get(params, PCM_BUFFER_SIZE, 0) / 2;
+	long period = pcm_get(params, PCM_PERIOD_SIZE, 0);
+	struct snd_pcm_status status;
+	struct timespec start, wake, now, trigger;
+	struct pcm_sync sync;
+	long fifo, frames, room;
+	int moved;
+
+	if (write_silence(fd, params, preroll) == -1)
+		return -1;
+
+	start = *target;
+	timespec_add_ns(&start, -preroll * NSEC_PER_SEC / rate);
+	wake = start;
+	timespec_add_ns(&wake, -START_SPIN_NS);
+
+	if (sleep_until(clock, &wake) == -1)
+		return -1;
+	do {
+		clock_gettime(clock, &now);
+	} while (timespec_diff_ns(&start, &now) > 0);
+
+	if (pcm_start(fd) == -1)
+		return -1;
+
+	// delay is the frames in buffer plus the frames in the device
+	if (ioctl(fd, SNDRV_PCM_IOCTL_STATUS, &status) == -1 ||
+	    pcm_action_timestamp(fd, &trigger) == -1)
+		return -1;
+	fifo = status.delay - (long) (status.appl_ptr - status.hw_ptr);
+	if (fifo < 0)
+		fifo = 0;
+
+	r->error = timespec_diff_ns(&trigger, target) +
+	           (preroll + fifo) * NSEC_PER_SEC / rate;
+	r->trimmed = 0;
+
+	// to the nearest frame
+	frames = (r->error * (long) rate +
+	          (r->error < 0 ? -NSEC_PER_SEC : NSEC_PER_SEC) / 2) / NSEC_PER_SEC;
+
+	if (flags & PCM_START_TRIM && frames < 0) {
+		if (write_silence(fd, params, -frames) == -1)
+			return -1;
+		r->trimmed = -frames;
+	} else if (flags & PCM_START_TRIM && frames > 0) {
+		// frames just ahead of hw_ptr may have been fetched by the DMA
+		if (pcm_sync(fd, &sync, PCM_REQUEST_HW) == -1)
+			return -1;
+		room = (long) (sync.control.appl_ptr - sync.status.hw_ptr) - period;
+		if (frames > room)
+			frames = room;
+		if (frames > 0) {
+			moved = pcm_move_app_pos(fd, -frames);
+			if (moved == -1)
+				return -1;
+			r->trimmed = moved;
+		}
+	}
+
+	r->residual = r->error + r->trimmed * NSEC_PER_SEC / rate;
+
+	return 0;
+}
+
+// The pre-roll must not start the stream: a start threshold up to it is
+// raised to the buffer size while starting, and restored after.
+int
+pcm_start_at(int fd, pcm_params_t *params, const struct timespec *target,
+             unsigned int flags, struct pcm_start_result *r)
+{
+	unsigned long threshold = pcm_get(params, PCM_START_THRESHOLD, 0);
+	unsigned long buffer_size = pcm_get(params, PCM_BUFFER_SIZE, 0);
+	int ret, error;
+
+	if (threshold > buffer_size / 2)
+		return start_at(fd, params, target, flags, r);
+
+	pcm_set(params, PCM_START_THRESHOLD, buffer_size);
+	ret = sw_params_send(fd, params);
+	if (ret == 0)
+		ret = start_at(fd, params, target, flags, r);
+
+	// keep the first error
+	error = errno;
+	pcm_set(params, PCM_START_THRESHOLD, threshold);
+	if (sw_params_send(fd, params) == -1 && ret == 0)
+		return -1;
+	errno = error;
+
+	return ret;
+}
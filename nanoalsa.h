@@ -10,6 +10,59 @@
 // Header for ALSA's interface in Linux kernel
 #include <sound/asound.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tracing
+// ========================================================================
+
+// If NANOALSA_TRACE is defined (when compiling both the library and the
+// application, as some entry points are inline), entry points emit trace
+// events. Otherwise, PCM_TRACE() expands to nothing.
+//
+// Each event is a USDT probe nanoalsa:event(event, fd, a, b) if
+// <sys/sdt.h> is available, and a call to pcm_trace_hook if it is set
+// (see tools/trace.h for a recorder).
+//
+// Events that take time (e.g. a blocking write) have a begin event and
+// a PCM_TRACE_END event, in the same thread.
+enum pcm_trace_event {
+	PCM_TRACE_END,    // a: return value
+	PCM_TRACE_WRITE,  // a: frames
+	PCM_TRACE_READ,   // a: frames
+	PCM_TRACE_ACTION, // a: ioctl request (pcm_ioctl_t), b: argument
+	PCM_TRACE_SETUP,  // a: 0 pcm_params_setup(), 1 pcm_reconfigure()
+	PCM_TRACE_SLEEP,  // a: hardware position to wait for (pcm_timer_wait())
+	PCM_TRACE_SYNC,   // a: hw_ptr, b: appl_ptr (instant)
+	PCM_TRACE_STATE,  // a: state (pcm_state_t) (instant)
+};
+typedef enum pcm_trace_event pcm_trace_event_t;
+
+#ifdef NANOALSA_TRACE
+
+extern void (*pcm_trace_hook)(int event, int fd, long a, long b);
+
+#if defined(__has_include) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PCM_TRACE_PROBE(event, fd, a, b) \
+	DTRACE_PROBE4(nanoalsa, event, event, fd, a, b)
+#else
+#define PCM_TRACE_PROBE(event, fd, a, b) ((void) 0)
+#endif
+
+#define PCM_TRACE(event, fd, a, b) do { \
+	PCM_TRACE_PROBE(event, fd, a, b); \
+	if (pcm_trace_hook) \
+		pcm_trace_hook(event, fd, a, b); \
+} while (0)
+
+#else
+
+#define PCM_TRACE(event, fd, a, b) ((void) 0)
+
+#endif // NANOALSA_TRACE
+
 // System call wrappers for time and position synchronization
 // ========================================================================
 
@@ -61,6 +114,45 @@ pcm_sync(int fd, pcm_sync_t *sync, unsigned int flags);
 int
 pcm_action_timestamp(int fd, struct timespec *ts);
 
+// Timer-scheduled wakeups
+// ========================================================================
+
+// With PCM_INTERRUPT set, the device does not wake up the application at
+// each period. Instead, the application sleeps on a timer until the
+// hardware position is predicted to reach a given position (e.g. the
+// refill watermark).
+//
+// The prediction uses the rate measured from hw_ptr and timestamp of
+// previous pcm_sync() calls. Wakeup is anticipated by a margin that
+// adapts to the observed lateness.
+//
+// pcm_timer_init() takes the nominal rate, which must not be zero (it
+// fails with EINVAL).
+//
+// The timer is on CLOCK_MONOTONIC. Positions are compared by their
+// signed difference, which is wrong only if hw_ptr wraps on boundary
+// (see sw_params) during the wait. On 64-bit it never happens.
+struct pcm_timer {
+	int fd;             // timerfd
+	double rate;        // measured frames per second
+	unsigned long hw_ptr;   // last hardware position and
+	struct timespec tstamp; // its timestamp (for measuring rate)
+	long lateness;      // mean lateness of wakeups (ns)
+	long deviation;     // mean absolute deviation of lateness (ns)
+	long margin;        // wakeup anticipation (ns)
+};
+typedef struct pcm_timer pcm_timer_t;
+
+int
+pcm_timer_init(pcm_timer_t *timer, unsigned int rate);
+
+int
+pcm_timer_wait(int fd, pcm_timer_t *timer, unsigned long hw_pos,
+               pcm_sync_t *sync);
+
+void
+pcm_timer_close(pcm_timer_t *timer);
+
 // Helpers for setting up parameters on the PCM device
 // ========================================================================
 
@@ -173,6 +265,69 @@ pcm_params_refine(int fd, pcm_params_t *params);
 int
 pcm_params_setup(int fd, pcm_params_t *params);
 
+// Change the configuration of a set up stream from `from` (as set up by
+// pcm_params_setup() or pcm_reconfigure()) to `to`, on the same file
+// descriptor. The stream is stopped (see pcm_drain() for playing what
+// is buffered first). Then:
+//
+// - If the configuration in use is allowed by the hardware parameters
+//   in `to`, it is kept: the buffer is not freed, so mappings of it
+//   remain valid. Otherwise, HW_FREE and HW_PARAMS are done (mappings
+//   must be unmapped before, or the kernel fails with EBADFD).
+// - Software parameters are sent only if they changed (or the hardware
+//   ones did, as HW_PARAMS resets them).
+// - The stream is prepared.
+//
+// On return, `to` has the configuration in use. If `latency_ns` is not
+// NULL, it is set to the time taken.
+int
+pcm_reconfigure(int fd, pcm_params_t *from, pcm_params_t *to,
+                long *latency_ns);
+
+// Buffer pool
+// ========================================================================
+
+// Buffers sized from a configured stream (e.g. one period each), for
+// applications that must not call the general allocator (nor take page
+// faults) after startup.
+//
+// All buffers are in one mapping, populated at pcm_pool_init(). Each
+// buffer is aligned to 64 bytes (cache line, SIMD loads), or to the page
+// size with PCM_POOL_PAGE_ALIGN. pcm_pool_get() and pcm_pool_put() are
+// O(1) and lock-free, and may be called from any thread.
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define PCM_POOL_PAGE_ALIGN (1 << 0) // align buffers to page size
+#define PCM_POOL_HUGEPAGES  (1 << 1) // try hugepages, fallback to pages
+#define PCM_POOL_LOCK       (1 << 2) // mlock() the pool
+
+struct pcm_pool {
+	char *memory;
+	size_t memory_size;
+	size_t buffer_size; // bytes of each buffer (rounded up to alignment)
+	unsigned int count;
+	unsigned int *next; // free list links
+	uint64_t head;      // free list head (tag << 32 | index)
+};
+typedef struct pcm_pool pcm_pool_t;
+
+// `size` is the parameter that gives the size of each buffer, e.g.
+// PCM_PERIOD_BYTES or PCM_BUFFER_BYTES. `params` must have been set up.
+int
+pcm_pool_init(pcm_pool_t *pool, pcm_params_t *params, pcm_param_t size,
+              unsigned int count, int flags);
+
+void*
+pcm_pool_get(pcm_pool_t *pool);
+
+void
+pcm_pool_put(pcm_pool_t *pool, void *buffer);
+
+void
+pcm_pool_destroy(pcm_pool_t *pool);
+
 // Helper for opening Linux PCM device
 // ========================================================================
 
@@ -224,24 +379,43 @@ enum pcm_ioctl {
 };
 typedef enum pcm_ioctl pcm_ioctl_t;
 
-static inline int pcm_prepare(int fd) { return ioctl(fd, PCM_ACTION_PREPARE); }
-static inline int pcm_start(int fd)   { return ioctl(fd, PCM_ACTION_START); }
-static inline int pcm_stop(int fd)    { return ioctl(fd, PCM_ACTION_STOP); }
-static inline int pcm_drain(int fd)   { return ioctl(fd, PCM_ACTION_DRAIN); }
-static inline int pcm_xrun(int fd)    { return ioctl(fd, PCM_ACTION_XRUN); }
-static inline int pcm_reset(int fd)   { return ioctl(fd, PCM_ACTION_RESET); }
-static inline int pcm_resume(int fd)  { return ioctl(fd, PCM_ACTION_RESUME); }
-static inline int pcm_pause(int fd)   { return ioctl(fd, PCM_ACTION_PAUSE, 1); }
-static inline int pcm_unpause(int fd) { return ioctl(fd, PCM_ACTION_PAUSE, 0); }
+// Do an action (or another ioctl with an integer argument)
+static inline int
+pcm_action(int fd, pcm_ioctl_t action, int arg)
+{
+	int ret;
+	PCM_TRACE(PCM_TRACE_ACTION, fd, action, arg);
+	ret = ioctl(fd, action, arg);
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
+}
+
+static inline int pcm_prepare(int fd) { return pcm_action(fd, PCM_ACTION_PREPARE, 0); }
+static inline int pcm_start(int fd)   { return pcm_action(fd, PCM_ACTION_START, 0); }
+static inline int pcm_stop(int fd)    { return pcm_action(fd, PCM_ACTION_STOP, 0); }
+static inline int pcm_drain(int fd)   { return pcm_action(fd, PCM_ACTION_DRAIN, 0); }
+static inline int pcm_xrun(int fd)    { return pcm_action(fd, PCM_ACTION_XRUN, 0); }
+static inline int pcm_reset(int fd)   { return pcm_action(fd, PCM_ACTION_RESET, 0); }
+static inline int pcm_resume(int fd)  { return pcm_action(fd, PCM_ACTION_RESUME, 0); }
+static inline int pcm_pause(int fd)   { return pcm_action(fd, PCM_ACTION_PAUSE, 1); }
+static inline int pcm_unpause(int fd) { return pcm_action(fd, PCM_ACTION_PAUSE, 0); }
 
 // Useful only when status (pcm_status_t) is mmapped as it does not return
 // the updated position (for that, see pcm_sync() which returns it).
 static inline int pcm_mmap_sync_pos(int fd) { return ioctl(fd, PCM_MMAP_SYNC_POSITION); }
 
-// Increment or decrement application position
+// Increment or decrement application position. The kernel may move less
+// than requested. Return the frames actually moved (negative if moved
+// backward), or -1 on error.
 static inline int pcm_move_app_pos(int fd, int frames) {
-	return frames < 0 ? ioctl(fd, PCM_DO_REWIND, -frames)
-	                  : ioctl(fd, PCM_DO_FORWARD, frames);
+	snd_pcm_uframes_t tmp = frames < 0 ? -frames : frames;
+	pcm_ioctl_t request = frames < 0 ? PCM_DO_REWIND : PCM_DO_FORWARD;
+	int ret;
+	PCM_TRACE(PCM_TRACE_ACTION, fd, request, frames);
+	ret = ioctl(fd, request, &tmp) == -1 ? -1 :
+	      frames < 0 ? -(int) tmp : (int) tmp;
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
 }
 
 static inline int pcm_link(int fd, int fd2) { return ioctl(fd, PCM_DO_LINK, fd2); }
@@ -253,17 +427,23 @@ static inline int pcm_unlink(int fd) { return ioctl(fd, PCM_DO_UNLINK); }
 static inline int
 pcm_write(int fd, void *buf, int frames)
 {
-	struct snd_xferi tmp = {.buf = buf, .frames = frames, .result = 0};
-	return ioctl(fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &tmp) ? -1 :
-	       (int) tmp.result;
+	struct snd_xferi tmp = {.result = 0, .buf = buf, .frames = (snd_pcm_uframes_t) frames};
+	int ret;
+	PCM_TRACE(PCM_TRACE_WRITE, fd, frames, 0);
+	ret = ioctl(fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &tmp) ? -1 : (int) tmp.result;
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
 }
 
 static inline int
 pcm_read(int fd, void *buf, int frames)
 {
-	struct snd_xferi tmp = {.buf = buf, .frames = frames, .result = 0};
-	return ioctl(fd, SNDRV_PCM_IOCTL_READI_FRAMES, &tmp) ? -1 :
-	       (int) tmp.result;
+	struct snd_xferi tmp = {.result = 0, .buf = buf, .frames = (snd_pcm_uframes_t) frames};
+	int ret;
+	PCM_TRACE(PCM_TRACE_READ, fd, frames, 0);
+	ret = ioctl(fd, SNDRV_PCM_IOCTL_READI_FRAMES, &tmp) ? -1 : (int) tmp.result;
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
 }
 
 // Unlike writev, the second argument is an array of n_channels pointers to
@@ -271,9 +451,12 @@ pcm_read(int fd, void *buf, int frames)
 static inline int
 pcm_write_scattered(int fd, void **bufs, int frames)
 {
-	struct snd_xfern tmp = {.bufs = bufs, .frames = frames, .result = 0};
-	return ioctl(fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &tmp) ? -1 :
-	       (int) tmp.result;
+	struct snd_xfern tmp = {.result = 0, .bufs = bufs, .frames = (snd_pcm_uframes_t) frames};
+	int ret;
+	PCM_TRACE(PCM_TRACE_WRITE, fd, frames, 0);
+	ret = ioctl(fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &tmp) ? -1 : (int) tmp.result;
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
 }
 
 // Unlike readv, the second argument is an array of n_channels pointers to
@@ -281,9 +464,80 @@ pcm_write_scattered(int fd, void **bufs, int frames)
 static inline int
 pcm_read_scattered(int fd, void **bufs, int frames)
 {
-	struct snd_xfern tmp = {.bufs = bufs, .frames = frames, .result = 0};
-	return ioctl(fd, SNDRV_PCM_IOCTL_READN_FRAMES, &tmp) ? -1 :
-	       (int) tmp.result;
+	struct snd_xfern tmp = {.result = 0, .bufs = bufs, .frames = (snd_pcm_uframes_t) frames};
+	int ret;
+	PCM_TRACE(PCM_TRACE_READ, fd, frames, 0);
+	ret = ioctl(fd, SNDRV_PCM_IOCTL_READN_FRAMES, &tmp) ? -1 : (int) tmp.result;
+	PCM_TRACE(PCM_TRACE_END, fd, ret, 0);
+	return ret;
+}
+
+// Late updates
+// ========================================================================
+
+// A playback stream may keep a deep buffer (few wakeups) and still react
+// quickly to new events: the not yet played part of the buffer is
+// rewound and rendered again with the new content.
+//
+// Frames just ahead of hw_ptr may already have been fetched by the DMA,
+// so they are not rewound. The size of DMA transfers is measured as the
+// smallest advance of hw_ptr observed between calls to pcm_late_observe().
+struct pcm_late {
+	unsigned long hw_ptr; // last observed hardware position
+	unsigned long step;   // measured DMA granularity (frames)
+	int seeded;           // hw_ptr has been observed once
+};
+typedef struct pcm_late pcm_late_t;
+
+static inline void
+pcm_late_init(pcm_late_t *late)
+{
+	late->hw_ptr = 0;
+	late->step = 0;
+	late->seeded = 0;
+}
+
+void
+pcm_late_observe(pcm_late_t *late, pcm_sync_t *sync);
+
+int
+pcm_late_rewind(int fd, pcm_late_t *late, unsigned long margin,
+                unsigned long *appl_ptr);
+
+// Scheduled start
+// ========================================================================
+
+// Start a prepared playback stream so that the next frame written after
+// pcm_start_at() plays at `target`. Target is on the clock of the stream
+// timestamps (see PCM_TSTAMP_TYPE; CLOCK_REALTIME if not set), so that
+// the trigger timestamp can be compared with it.
+//
+// Half the buffer size is the pre-roll: silence written before starting.
+// A start threshold that the pre-roll would reach (e.g. the default of 1)
+// is raised while starting and restored after. The stream is started when
+// the pre-roll has to begin, sleeping until shortly before and then
+// spinning. The time the next frame plays is then the trigger timestamp
+// (see pcm_action_timestamp()) plus the pre-roll plus the device delay
+// (e.g. FIFO) measured from status.
+//
+// With PCM_START_TRIM, the error is corrected to the nearest frame: if
+// early, silence is added; if late, the pre-roll not yet played is
+// rewound (up to a period ahead of the hardware position).
+#define PCM_START_TRIM (1 << 0)
+
+struct pcm_start_result {
+	long error;    // ns the next frame plays after target (before trim)
+	long residual; // ns the next frame plays after target
+	int trimmed;   // frames of silence added (negative if removed)
+};
+typedef struct pcm_start_result pcm_start_result_t;
+
+int
+pcm_start_at(int fd, pcm_params_t *params, const struct timespec *target,
+             unsigned int flags, pcm_start_result_t *result);
+
+#ifdef __cplusplus
 }
+#endif
 
 #endif // NANOALSA_H
@@ -0,0 +1,149 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Compare the transfers of nanoalsa.hpp with the C calls they wrap.
+//
+// Each pair writes the same period with the C call and with the Stream
+// method, and reports nanoseconds per call (best of some runs of each,
+// alternated so that both sides see the same conditions). The ioctl is
+// made on /dev/null, where it fails at once, so what is measured is the
+// trip to the kernel and back plus the work done around it. For native
+// byte order, both sides should be the same. For foreign order, the C
+// side does what the Stream does: it swaps a chunk of scratch_frames
+// into a scratch buffer and writes it, and stops at the first error.
+//
+// E.g.: ./cxxbench -f 256 -n 1000000
+
+#include <chrono>   // std::chrono::steady_clock
+#include <cstdio>   // std::printf(), std::perror()
+#include <cstdlib>  // std::atoi()
+#include <fcntl.h>  // open()
+#include <unistd.h> // getopt()
+#include <vector>   // std::vector
+
+#include "nanoalsa.hpp"
+
+using namespace nanoalsa;
+
+#define CHANNELS 2
+#define RUNS 9
+
+static int iterations = 1000000;
+
+// nanoseconds per call of `f`
+template <typename F>
+static double
+measure(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		f();
+	std::chrono::duration<double, std::nano> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	return elapsed.count() / iterations;
+}
+
+// Best of RUNS runs of each, alternated
+template <typename C, typename CXX>
+static void
+compare(const char *name, C c, CXX cxx)
+{
+	double best_c = 0, best_cxx = 0, t;
+
+	for (int run = 0; run < RUNS; run++) {
+		t = measure(c);
+		if (!run || t < best_c)
+			best_c = t;
+		t = measure(cxx);
+		if (!run || t < best_cxx)
+			best_cxx = t;
+	}
+
+	std::printf("%-22s %8.1f %8.1f %+7.1f%%\n", name, best_c, best_cxx,
+	            (best_cxx - best_c) / best_c * 100);
+}
+
+// A stream adopting /dev/null set up as if it had `Format` and `Access`
+template <pcm_format_t Format, pcm_access_t Access>
+static Stream<Format, CHANNELS, Access>
+null_stream(void)
+{
+	pcm_params_t params;
+	int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		throw std::system_error(errno, std::generic_category(), "open");
+
+	pcm_params_init(&params);
+	pcm_set(&params, PCM_ACCESS,   Access);
+	pcm_set(&params, PCM_FORMAT,   Format);
+	pcm_set(&params, PCM_CHANNELS, CHANNELS);
+
+	return Stream<Format, CHANNELS, Access>(Device(fd), params);
+}
+
+int
+main(int argc, char **argv)
+{
+	int frames = 256, opt;
+
+	while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+		switch (opt) {
+		case 'f': frames = std::atoi(optarg); break;
+		case 'n': iterations = std::atoi(optarg); break;
+		default:
+			std::fputs("usage: cxxbench [-f frames] [-n iterations]\n",
+			           stderr);
+			return 1;
+		}
+	}
+	if (frames <= 0 || iterations <= 0)
+		return 1;
+
+	std::vector<int16_t> samples(frames * CHANNELS);
+	std::vector<int16_t> left(frames), right(frames);
+
+	auto interleaved = null_stream<PCM_FORMAT_S16_LE, PCM_ACCESS_RW>();
+	auto scattered = null_stream<PCM_FORMAT_S16_LE, PCM_ACCESS_RW_SCATTERED>();
+	auto swapped = null_stream<PCM_FORMAT_S16_BE, PCM_ACCESS_RW>();
+	decltype(scattered)::buffer channels{left, right};
+	const int chunk = decltype(swapped)::scratch_frames;
+	std::vector<int16_t> scratch(chunk * CHANNELS);
+
+	std::printf("%-22s %8s %8s %8s\n", "ns per call", "C", "C++", "");
+
+	compare("interleaved",
+		[&] { pcm_write(interleaved.fd(), samples.data(), frames); },
+		[&] { interleaved.write(samples); });
+
+	compare("scattered",
+		[&] {
+			void *bufs[CHANNELS] = {left.data(), right.data()};
+			pcm_write_scattered(scattered.fd(), bufs, frames);
+		},
+		[&] { scattered.write(channels); });
+
+	compare("interleaved, swapped",
+		[&] {
+			int written = 0, n, ret, i;
+			while (written < frames) {
+				n = frames - written < chunk ? frames - written : chunk;
+				for (i = 0; i < n * CHANNELS; i++)
+					scratch[i] = __builtin_bswap16(
+						samples[written * CHANNELS + i]);
+				ret = pcm_write(swapped.fd(), scratch.data(), n);
+				if (ret == -1)
+					break;
+				written += ret;
+				if (ret < n)
+					break;
+			}
+		},
+		[&] { swapped.write(samples); });
+
+	return 0;
+}
@@ -0,0 +1,432 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Serve many PCM streams with a pool of worker threads, one per CPU.
+//
+// Each worker runs its own event loop (epoll) over the file descriptors
+// of its streams, which are nonblocking. When a stream is ready, its
+// process() callback transfers (and renders) data.
+//
+// Load of a worker is the sum of the utilization of its streams, i.e.
+// processing time per period time. The period is the deadline of each
+// stream: a worker over 100% misses deadlines. Processing time is
+// measured, so a spike of DSP cost in some streams raises the load of
+// their worker.
+//
+// Load is balanced by work stealing: a worker under the average load
+// takes a stream from the most loaded worker. Migration is done by the
+// owner of the stream, between two calls of process(), so a stream is
+// never processed by two workers at once:
+//
+//   thief                     owner
+//   -----                     -----
+//   stream->migrate_to = me
+//                             process(stream)
+//                             remove stream from epoll and list
+//                             push to thief's inbox, signal eventfd
+//   take from inbox
+//   add stream to epoll and list
+//
+// A worker asks for a stream only if it has room for it. If a migrated
+// stream still cannot be added (e.g. epoll_ctl() fails), it is handed
+// back to the worker it came from; if that fails too, or a new stream
+// cannot be added, the stream is dropped: its drop() callback is called
+// with the error.
+//
+// Pinning needs _GNU_SOURCE defined before including any header.
+
+#include <errno.h>       // errno, ENOSPC
+#include <pthread.h>     // pthread_*
+#include <sched.h>       // cpu_set_t, CPU_SET()
+#include <stdatomic.h>   // atomic_*
+#include <stdint.h>      // uint64_t
+#include <stdlib.h>      // calloc(), free()
+#include <sys/epoll.h>   // epoll_*()
+#include <sys/eventfd.h> // eventfd()
+#include <time.h>        // clock_gettime()
+#include <unistd.h>      // read(), write(), close(), sysconf()
+
+#define ENGINE_MAX_STREAMS 1024 // per worker
+
+// Load is in parts per million of one CPU
+#define ENGINE_LOAD_FULL 1000000L
+
+// A worker steals only if the difference between its load and the
+// average is above this (avoids streams bouncing between workers).
+#define ENGINE_STEAL_THRESHOLD (ENGINE_LOAD_FULL / 20)
+
+// Stealing is considered at this interval (ns)
+#define ENGINE_STEAL_INTERVAL 100000000L
+
+struct engine_stream {
+	int fd;
+	unsigned int events; // epoll events, e.g. EPOLLOUT for playback
+
+	// Called when fd is ready. Return -1 (with errno set) to remove the
+	// stream from the engine: drop() is then called.
+	int (*process)(struct engine_stream *stream);
+	void *data;
+
+	// Called when the stream leaves the engine with an error: the one
+	// of process(), or the engine's if it cannot take the stream (ENOSPC
+	// if workers are full). fd is no longer watched by the engine, and
+	// the callback owns it. If NULL, fd is closed.
+	void (*drop)(struct engine_stream *stream, int error);
+
+	long period_ns; // deadline
+	long cost_ns;   // mean processing time (measured)
+
+	atomic_int migrate_to; // worker that asked for this stream, or -1
+	int worker; // where it was last added, or -1 (new or handed back)
+
+	struct engine_stream *next; // in inbox
+};
+
+struct engine_worker {
+	struct engine *engine;
+	int id;
+	pthread_t thread;
+
+	int epoll_fd;
+	int event_fd; // signals inbox
+
+	// streams added to or migrated to this worker
+	pthread_mutex_t inbox_lock;
+	struct engine_stream *inbox;
+	atomic_int incoming; // pushed and not yet taken from inbox
+
+	// streams of this worker (lock is only for changing and stealing)
+	pthread_mutex_t lock;
+	struct engine_stream *streams[ENGINE_MAX_STREAMS];
+	int n_streams;
+
+	atomic_long load;
+	unsigned long migrations; // streams given to other workers
+};
+
+struct engine {
+	int n_workers;
+	struct engine_worker *workers;
+	atomic_int running;
+};
+
+static inline long
+engine_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static inline long
+engine_stream_load(struct engine_stream *s)
+{
+	return s->cost_ns * ENGINE_LOAD_FULL / s->period_ns;
+}
+
+// Room for one more stream, counting the ones on their way
+static inline int
+worker_has_room(struct engine_worker *w)
+{
+	return w->n_streams + atomic_load(&w->incoming) < ENGINE_MAX_STREAMS;
+}
+
+static void
+engine_drop(struct engine_stream *s, int error)
+{
+	if (s->drop)
+		s->drop(s, error);
+	else
+		close(s->fd);
+}
+
+static void
+engine_push(struct engine_worker *w, struct engine_stream *s)
+{
+	uint64_t one = 1;
+
+	atomic_fetch_add(&w->incoming, 1);
+	pthread_mutex_lock(&w->inbox_lock);
+	s->next = w->inbox;
+	w->inbox = s;
+	pthread_mutex_unlock(&w->inbox_lock);
+
+	write(w->event_fd, &one, sizeof(one));
+}
+
+static void
+worker_take_inbox(struct engine_worker *w)
+{
+	struct engine_stream *s, *next;
+	struct engine_worker *source;
+	struct epoll_event ev;
+	uint64_t count;
+	int error;
+
+	read(w->event_fd, &count, sizeof(count));
+
+	pthread_mutex_lock(&w->inbox_lock);
+	s = w->inbox;
+	w->inbox = NULL;
+	pthread_mutex_unlock(&w->inbox_lock);
+
+	for (; s; s = next) {
+		next = s->next;
+		atomic_store(&s->migrate_to, -1);
+		atomic_fetch_sub(&w->incoming, 1);
+
+		ev.events = s->events;
+		ev.data.ptr = s;
+		if (w->n_streams < ENGINE_MAX_STREAMS &&
+		    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, s->fd, &ev) == 0) {
+			s->worker = w->id;
+			pthread_mutex_lock(&w->lock);
+			w->streams[w->n_streams++] = s;
+			pthread_mutex_unlock(&w->lock);
+			continue;
+		}
+
+		error = w->n_streams < ENGINE_MAX_STREAMS ? errno : ENOSPC;
+		if (s->worker == -1 || s->worker == w->id) {
+			engine_drop(s, error);
+			continue;
+		}
+
+		// back to where it came from, once
+		source = &w->engine->workers[s->worker];
+		s->worker = -1;
+		engine_push(source, s);
+	}
+}
+
+static void
+worker_remove(struct engine_worker *w, struct engine_stream *s)
+{
+	int i;
+
+	epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+
+	pthread_mutex_lock(&w->lock);
+	for (i = 0; i < w->n_streams; i++) {
+		if (w->streams[i] == s) {
+			w->streams[i] = w->streams[--w->n_streams];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void
+worker_update_load(struct engine_worker *w)
+{
+	long load = 0;
+	int i;
+
+	for (i = 0; i < w->n_streams; i++)
+		load += engine_stream_load(w->streams[i]);
+
+	atomic_store_explicit(&w->load, load, memory_order_relaxed);
+}
+
+// Ask the most loaded worker for the stream that best halves the load
+// difference between it and this worker.
+static void
+worker_steal(struct engine_worker *w)
+{
+	struct engine *e = w->engine;
+	struct engine_worker *victim = NULL;
+	struct engine_stream *best = NULL;
+	long load, my_load, max_load = 0, total = 0, average, want, s_load;
+	int i, expected;
+
+	my_load = atomic_load_explicit(&w->load, memory_order_relaxed);
+	for (i = 0; i < e->n_workers; i++) {
+		load = atomic_load_explicit(&e->workers[i].load,
+		                            memory_order_relaxed);
+		total += load;
+		if (load > max_load) {
+			max_load = load;
+			victim = &e->workers[i];
+		}
+	}
+	average = total / e->n_workers;
+
+	if (victim == w || average - my_load < ENGINE_STEAL_THRESHOLD ||
+	    !worker_has_room(w))
+		return;
+
+	want = (max_load - my_load) / 2;
+
+	pthread_mutex_lock(&victim->lock);
+	for (i = 0; i < victim->n_streams; i++) {
+		s_load = engine_stream_load(victim->streams[i]);
+		if (s_load <= want &&
+		    (!best || s_load > engine_stream_load(best)))
+			best = victim->streams[i];
+	}
+	expected = -1;
+	if (best)
+		atomic_compare_exchange_strong(&best->migrate_to, &expected, w->id);
+	pthread_mutex_unlock(&victim->lock);
+}
+
+static void
+worker_process(struct engine_worker *w, struct engine_stream *s)
+{
+	long start = engine_now(), cost;
+	int target, error;
+
+	// fd is closed by drop(), after it is out of epoll
+	if (s->process(s) == -1) {
+		error = errno;
+		worker_remove(w, s);
+		engine_drop(s, error);
+		return;
+	}
+
+	// mean of processing time (weight 1/8)
+	cost = engine_now() - start;
+	s->cost_ns += (cost - s->cost_ns) / 8;
+
+	target = atomic_load_explicit(&s->migrate_to, memory_order_relaxed);
+	if (target != -1 && target != w->id) {
+		worker_remove(w, s);
+		engine_push(&w->engine->workers[target], s);
+		w->migrations++;
+	}
+}
+
+static void*
+worker_loop(void *arg)
+{
+	struct engine_worker *w = arg;
+	struct epoll_event events[64];
+	long last_steal = engine_now(), now;
+	int i, n;
+
+	while (atomic_load_explicit(&w->engine->running, memory_order_relaxed)) {
+		n = epoll_wait(w->epoll_fd, events, 64,
+		               ENGINE_STEAL_INTERVAL / 1000000);
+
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.ptr)
+				worker_take_inbox(w);
+			else
+				worker_process(w, events[i].data.ptr);
+		}
+
+		now = engine_now();
+		if (now - last_steal >= ENGINE_STEAL_INTERVAL) {
+			worker_update_load(w);
+			worker_steal(w);
+			last_steal = now;
+		}
+	}
+
+	return NULL;
+}
+
+// Stop the first `n` workers (they are running) and free them all
+static void
+engine_join(struct engine *e, int n)
+{
+	int i;
+
+	atomic_store(&e->running, 0);
+	for (i = 0; i < n; i++) {
+		pthread_join(e->workers[i].thread, NULL);
+		close(e->workers[i].epoll_fd);
+		close(e->workers[i].event_fd);
+	}
+
+	free(e->workers);
+}
+
+// Create one worker per CPU (if n_workers is zero) and start them. On
+// error, workers already started are stopped.
+static int
+engine_start(struct engine *e, int n_workers)
+{
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	struct engine_worker *w;
+	cpu_set_t cpus;
+	int i, error, n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (!n_workers)
+		n_workers = n_cpus;
+
+	e->n_workers = n_workers;
+	e->workers = calloc(n_workers, sizeof(*e->workers));
+	if (!e->workers)
+		return -1;
+	atomic_store(&e->running, 1);
+
+	for (i = 0; i < n_workers; i++) {
+		w = &e->workers[i];
+		w->engine = e;
+		w->id = i;
+		pthread_mutex_init(&w->inbox_lock, NULL);
+		pthread_mutex_init(&w->lock, NULL);
+
+		w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		w->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (w->epoll_fd == -1 || w->event_fd == -1 ||
+		    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &ev) == -1)
+			error = errno;
+		else
+			error = pthread_create(&w->thread, NULL, worker_loop, w);
+
+		if (error) {
+			if (w->epoll_fd != -1)
+				close(w->epoll_fd);
+			if (w->event_fd != -1)
+				close(w->event_fd);
+			engine_join(e, i);
+			errno = error;
+			return -1;
+		}
+
+		// pinning may be not permitted; it is not an error
+		CPU_ZERO(&cpus);
+		CPU_SET(i % n_cpus, &cpus);
+		pthread_setaffinity_np(w->thread, sizeof(cpus), &cpus);
+	}
+
+	return 0;
+}
+
+// Add a stream to the least loaded worker with room for it. If every
+// worker is full, the stream is dropped (see drop()).
+static void
+engine_add(struct engine *e, struct engine_stream *s)
+{
+	int i, best = -1;
+
+	atomic_init(&s->migrate_to, -1);
+	s->worker = -1;
+	s->cost_ns = 0;
+
+	for (i = 0; i < e->n_workers; i++) {
+		if (worker_has_room(&e->workers[i]) &&
+		    (best == -1 || atomic_load(&e->workers[i].load) <
+		                   atomic_load(&e->workers[best].load)))
+			best = i;
+	}
+	if (best == -1) {
+		engine_drop(s, ENOSPC);
+		return;
+	}
+
+	// count it now, so that streams added at once are spread
+	atomic_fetch_add(&e->workers[best].load, ENGINE_LOAD_FULL / 1000);
+	engine_push(&e->workers[best], s);
+}
+
+static void
+engine_stop(struct engine *e)
+{
+	engine_join(e, e->n_workers);
+}
@@ -0,0 +1,213 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Capture sound and deliver it to two consumers without copying (see
+// fanout.h): a recorder that writes raw PCM to stdout, and a meter that
+// measures each block (see meter.h). The levels are printed to stderr
+// every second by another thread, from the meter snapshot.
+//
+// With -g, the recorder gates its blocks with a meter of its own and does
+// not write silent ones.
+//
+// E.g.: ./fancap /dev/snd/pcmC0D0c > capture.raw
+//       ./fancap -g -50 /dev/snd/pcmC0D0c > speech.raw
+
+#include <fcntl.h>    // open()
+#include <pthread.h>  // pthread_create(), pthread_join()
+#include <signal.h>   // signal()
+#include <stdint.h>   // int16_t
+#include <stdio.h>    // perror(), fprintf()
+#include <stdlib.h>   // atof()
+#include <sys/stat.h> // open()
+#include <unistd.h>   // write(), close(), sleep(), getopt()
+
+#include "nanoalsa.h"
+#include "fanout.h"
+#include "meter.h"
+
+#define RATE     48000
+#define CHANNELS 2
+
+static volatile sig_atomic_t        keep_running = 1;
+static void on_sigint(int signum) { keep_running = 0; }
+
+#define RECORDER 0
+#define METER    1
+#define SUBSCRIBERS 2
+
+struct subscriber {
+	struct fanout *f;
+	int id;
+	struct meter *m; // recorder: gate (NULL if none)
+};
+
+static void*
+recorder(void *arg)
+{
+	struct subscriber *s = arg;
+	struct fanout_block *block;
+	int bytes;
+
+	while (keep_running) {
+		block = fanout_get(s->f, s->id, 1);
+		if (!block)
+			continue;
+		bytes = block->frames * s->f->frame_bytes;
+		if ((!s->m || meter_process(s->m, block->data, block->frames)) &&
+		    write(1, block->data, bytes) != bytes)
+			keep_running = 0;
+		fanout_put(s->f, block);
+	}
+
+	fanout_unsubscribe(s->f, s->id);
+	return NULL;
+}
+
+static void*
+meter(void *arg)
+{
+	struct subscriber *s = arg;
+	struct fanout_block *block;
+
+	while (keep_running) {
+		block = fanout_get(s->f, s->id, 1);
+		if (!block)
+			continue;
+		meter_process(s->m, block->data, block->frames);
+		fanout_put(s->f, block);
+	}
+
+	fanout_unsubscribe(s->f, s->id);
+	return NULL;
+}
+
+static void*
+status(void *arg)
+{
+	struct subscriber *s = arg;
+	struct meter_snapshot snapshot, gate;
+	int c;
+
+	while (keep_running) {
+		sleep(1);
+		meter_read(s[METER].m, &snapshot);
+		for (c = 0; c < snapshot.channels; c++) {
+			fprintf(stderr, "%d: peak %6.1f dB  rms %6.1f dB  clips %lu  ",
+			        c, meter_db(snapshot.level[c].peak),
+			        meter_db(snapshot.level[c].rms),
+			        snapshot.level[c].clips);
+		}
+		if (s[RECORDER].m) {
+			meter_read(s[RECORDER].m, &gate);
+			fprintf(stderr, "gated %lu/%lu  ", gate.gated, gate.blocks);
+		}
+		fprintf(stderr, "dropped %lu/%lu  overruns %lu  xruns %lu\n",
+		        atomic_load(&s->f->queues[s[RECORDER].id].dropped),
+		        atomic_load(&s->f->queues[s[METER].id].dropped),
+		        s->f->overruns, s->f->xruns);
+	}
+
+	return NULL;
+}
+
+static int
+fancap(char *device, double gate)
+{
+	struct subscriber subscribers[SUBSCRIBERS];
+	void *(*routines[SUBSCRIBERS])(void*) = {recorder, meter};
+	pthread_t threads[SUBSCRIBERS + 1];
+	pcm_params_t params;
+	struct fanout f;
+	static struct meter levels, gate_meter;
+	int fd, i;
+
+	fd = open(device, O_RDWR);
+	if (fd == -1) {
+		perror(device);
+		return -1;
+	}
+
+	pcm_params_init(&params);
+	pcm_set(&params, PCM_ACCESS,      PCM_ACCESS_RW);
+	pcm_set(&params, PCM_FORMAT,      PCM_FORMAT_S16_LE);
+	pcm_set(&params, PCM_RATE,        RATE);
+	pcm_set(&params, PCM_CHANNELS,    CHANNELS);
+	pcm_set(&params, PCM_TSTAMP_TYPE, PCM_CLOCK_MONOTONIC);
+	if (pcm_params_setup(fd, &params) == -1) {
+		perror("Error while setting PCM parameters");
+		close(fd);
+		return -1;
+	}
+
+	if (fanout_init(&f, fd, &params, FANOUT_BLOCKS) == -1) {
+		perror("fanout_init");
+		close(fd);
+		return -1;
+	}
+
+	meter_init(&levels, PCM_FORMAT_S16_LE, CHANNELS);
+	subscribers[METER].m = &levels;
+	subscribers[RECORDER].m = NULL;
+	if (gate) {
+		meter_init(&gate_meter, PCM_FORMAT_S16_LE, CHANNELS);
+		meter_set_gate(&gate_meter, gate, RATE); // hold 1 second
+		subscribers[RECORDER].m = &gate_meter;
+	}
+
+	for (i = 0; i < SUBSCRIBERS; i++) {
+		subscribers[i].f = &f;
+		subscribers[i].id = fanout_subscribe(&f);
+		if (subscribers[i].id == -1) {
+			perror("fanout_subscribe");
+			fanout_destroy(&f);
+			close(fd);
+			return -1;
+		}
+	}
+	for (i = 0; i < SUBSCRIBERS; i++)
+		pthread_create(&threads[i], NULL, routines[i], &subscribers[i]);
+	pthread_create(&threads[SUBSCRIBERS], NULL, status, subscribers);
+
+	while (keep_running && fanout_read(&f) > 0);
+
+	keep_running = 0;
+	fanout_wake(&f);
+	for (i = 0; i <= SUBSCRIBERS; i++)
+		pthread_join(threads[i], NULL);
+
+	fanout_destroy(&f);
+	close(fd);
+
+	return 0;
+}
+
+static const char *usage =
+"usage: fancap [-g gate_db] [pcm_device_file]\n"
+"Default PCM device: /dev/snd/pcmC0D0c\n"
+"-g does not record blocks with RMS under gate_db (e.g. -50)\n";
+
+int
+main(int argc, char **argv)
+{
+	char *device = "/dev/snd/pcmC0D0c";
+	double gate = 0;
+	int opt;
+
+	signal(SIGINT, on_sigint);
+
+	while ((opt = getopt(argc, argv, "g:")) != -1) {
+		switch (opt) {
+		case 'g': gate = atof(optarg); break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		device = argv[optind];
+
+	return fancap(device, gate) == -1;
+}
@@ -0,0 +1,342 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Deliver one capture stream to multiple consumers without copying.
+//
+// The reader reads each period into a block of a fixed pool and
+// publishes the block to the queue of every subscriber. A block is
+// reference counted and returns to the pool when the last subscriber
+// puts it back.
+//
+//                     +-> queue -> subscriber 0
+// pcm_read() -> block +-> queue -> subscriber 1
+//                     +-> queue -> subscriber 2
+//
+// Each queue has a single producer (the reader) and a single consumer
+// (the subscriber), so it is lock-free with only two indexes. The reader
+// never waits: if a queue is full, the block is not delivered to that
+// subscriber and its `dropped` counter is incremented.
+//
+// The pool has a fixed size, whatever the number of subscribers: the
+// blocks are shared among them by limiting how many each queue holds. A
+// subscriber holds at most its queue plus the block it is working on, so
+// with a queue limit of (pool - 1) / subscribers - 1 the reader always
+// finds a free block. A slow subscriber fills its queue and loses blocks
+// (counted in its `dropped`), but it never takes blocks of the others.
+// So more subscribers make shorter queues, and fanout_subscribe() refuses
+// one that would leave a queue shorter than a block. If the pool has no
+// free block anyway (a subscriber holds more than one block), the period
+// is read into a scratch block and not published (counted in
+// `overruns`).
+
+#include <errno.h>       // errno, EINVAL, ENOSPC, EPIPE
+#include <stdatomic.h>   // atomic_*
+#include <stdint.h>      // uint64_t
+#include <stdlib.h>      // calloc(), free()
+#include <sys/eventfd.h> // eventfd()
+#include <time.h>        // struct timespec
+#include <unistd.h>      // read(), write(), close()
+
+#include "nanoalsa.h"
+
+#define FANOUT_MAX_SUBSCRIBERS 8
+
+// must be a power of two
+#define FANOUT_QUEUE_SIZE 16
+
+// pool size, e.g. for fanout_init()
+#define FANOUT_BLOCKS 32
+
+struct fanout_block {
+	atomic_uint refs;
+	int frames;
+	unsigned long position; // position of the first frame in the stream
+	struct timespec tstamp; // capture time of the first frame
+	char *data;
+};
+
+struct fanout_queue {
+	atomic_uint head; // written by reader
+	atomic_uint tail; // written by subscriber
+	unsigned int blocks[FANOUT_QUEUE_SIZE];
+	atomic_int active;
+	atomic_ulong dropped;
+	int event_fd; // signaled by reader on publish
+};
+
+struct fanout {
+	int fd;
+	unsigned int rate;
+	int frame_bytes;
+	int period_size;
+
+	// n_blocks for publishing plus one scratch block at the end
+	int n_blocks;
+	struct fanout_block *blocks;
+	char *memory;
+	int next; // where to search for a free block
+	int n_subscribers;
+	unsigned int queue_limit; // blocks a queue holds (see above)
+
+	unsigned long overruns;
+	unsigned long xruns; // the device overran (and was prepared)
+
+	struct fanout_queue queues[FANOUT_MAX_SUBSCRIBERS];
+};
+
+// `params` must be already set up on `fd`. `n_blocks` is the pool size,
+// at least 3 (a queue of one block for one subscriber).
+static int
+fanout_init(struct fanout *f, int fd, pcm_params_t *params, int n_blocks)
+{
+	int i;
+
+	if (n_blocks < 3) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	f->fd = fd;
+	f->rate = pcm_get(params, PCM_RATE, 0);
+	f->frame_bytes = pcm_get(params, PCM_FRAME_BITS, 0) / 8;
+	f->period_size = pcm_get(params, PCM_PERIOD_SIZE, 0);
+	f->n_blocks = n_blocks;
+	f->next = 0;
+	f->n_subscribers = 0;
+	f->queue_limit = FANOUT_QUEUE_SIZE;
+	f->overruns = 0;
+	f->xruns = 0;
+
+	f->blocks = calloc(n_blocks + 1, sizeof(*f->blocks));
+	f->memory = calloc(n_blocks + 1, f->period_size * f->frame_bytes);
+	if (!f->blocks || !f->memory) {
+		free(f->blocks);
+		free(f->memory);
+		return -1;
+	}
+
+	for (i = 0; i <= n_blocks; i++) {
+		atomic_init(&f->blocks[i].refs, 0);
+		f->blocks[i].data = f->memory + i * f->period_size * f->frame_bytes;
+	}
+
+	for (i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+		atomic_init(&f->queues[i].head, 0);
+		atomic_init(&f->queues[i].tail, 0);
+		atomic_init(&f->queues[i].active, 0);
+		atomic_init(&f->queues[i].dropped, 0);
+		f->queues[i].event_fd = -1;
+	}
+
+	return 0;
+}
+
+static void
+fanout_destroy(struct fanout *f)
+{
+	int i;
+
+	for (i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+		if (f->queues[i].event_fd != -1)
+			close(f->queues[i].event_fd);
+	}
+	free(f->blocks);
+	free(f->memory);
+}
+
+// Must be called before the reader starts. Return subscriber id, or -1
+// (ENOSPC if there are FANOUT_MAX_SUBSCRIBERS, or if the queues would
+// be shorter than a block).
+static int
+fanout_subscribe(struct fanout *f)
+{
+	long limit = (f->n_blocks - 1) / (f->n_subscribers + 1) - 1;
+	int i = f->n_subscribers;
+
+	if (i == FANOUT_MAX_SUBSCRIBERS || limit < 1) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	f->queues[i].event_fd = eventfd(0, EFD_CLOEXEC);
+	if (f->queues[i].event_fd == -1)
+		return -1;
+
+	f->queue_limit = limit < FANOUT_QUEUE_SIZE ? limit : FANOUT_QUEUE_SIZE;
+	f->n_subscribers++;
+	atomic_store(&f->queues[i].active, 1);
+	return i;
+}
+
+// Put a block back. When no one else holds it, it returns to the pool.
+static inline void
+fanout_put(struct fanout *f, struct fanout_block *block)
+{
+	atomic_fetch_sub_explicit(&block->refs, 1, memory_order_release);
+}
+
+static inline int
+fanout_queue_empty(struct fanout_queue *q, unsigned int tail)
+{
+	return tail == atomic_load_explicit(&q->head, memory_order_acquire);
+}
+
+// Get the next block for subscriber `id`. If `wait` is nonzero and the
+// queue is empty, wait for the reader to publish or for fanout_wake().
+// Return NULL if there is no block.
+static struct fanout_block*
+fanout_get(struct fanout *f, int id, int wait)
+{
+	struct fanout_queue *q = &f->queues[id];
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	unsigned int index;
+	uint64_t count;
+
+	if (fanout_queue_empty(q, tail) &&
+	    (!wait || read(q->event_fd, &count, sizeof(count)) == -1 ||
+	     fanout_queue_empty(q, tail)))
+		return NULL;
+
+	index = q->blocks[tail % FANOUT_QUEUE_SIZE];
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+	return &f->blocks[index];
+}
+
+// Stop delivering to subscriber `id`. Its pending blocks are put back by
+// the reader. Called by the subscriber itself, after its last
+// fanout_get().
+static inline void
+fanout_unsubscribe(struct fanout *f, int id)
+{
+	atomic_store_explicit(&f->queues[id].active, 0, memory_order_release);
+}
+
+// Wake up subscribers waiting in fanout_get() (e.g. for terminating)
+static void
+fanout_wake(struct fanout *f)
+{
+	uint64_t one = 1;
+	int i;
+
+	for (i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+		if (f->queues[i].event_fd != -1)
+			write(f->queues[i].event_fd, &one, sizeof(one));
+	}
+}
+
+static int
+fanout_get_free_block(struct fanout *f)
+{
+	int i, index;
+
+	for (i = 0; i < f->n_blocks; i++) {
+		index = (f->next + i) % f->n_blocks;
+		if (!atomic_load_explicit(&f->blocks[index].refs,
+		                          memory_order_acquire)) {
+			f->next = (index + 1) % f->n_blocks;
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+// Capture time of the frame at `position`, based on the hardware position
+// and its timestamp. The timestamp is zero if not enabled (see
+// PCM_TSTAMP_TYPE).
+static void
+fanout_tstamp(struct fanout *f, struct pcm_sync *sync, unsigned long position,
+              struct timespec *ts)
+{
+	long ns = (long) (sync->status.hw_ptr - position) * 1000000000L / f->rate;
+
+	*ts = sync->status.tstamp;
+	ts->tv_sec  -= ns / 1000000000L;
+	ts->tv_nsec -= ns % 1000000000L;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec--;
+		ts->tv_nsec += 1000000000L;
+	}
+}
+
+static void
+fanout_publish(struct fanout *f, int index)
+{
+	struct fanout_block *block = &f->blocks[index], *pending;
+	struct fanout_queue *q;
+	unsigned int head;
+	uint64_t one = 1;
+	int i;
+
+	// reader holds a reference while publishing
+	atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+
+	for (i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+		q = &f->queues[i];
+		if (!atomic_load_explicit(&q->active, memory_order_acquire)) {
+			// put back blocks left by a subscriber that is gone
+			while ((pending = fanout_get(f, i, 0)))
+				fanout_put(f, pending);
+			continue;
+		}
+
+		head = atomic_load_explicit(&q->head, memory_order_relaxed);
+		if (head - atomic_load_explicit(&q->tail, memory_order_acquire) >=
+		    f->queue_limit) {
+			atomic_fetch_add_explicit(&q->dropped, 1,
+			                          memory_order_relaxed);
+			continue;
+		}
+
+		atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+		q->blocks[head % FANOUT_QUEUE_SIZE] = index;
+		atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+		// eventfd counter never overflows in practice (2^64 - 2)
+		while (write(q->event_fd, &one, sizeof(one)) == -1 &&
+		       errno == EINTR);
+	}
+
+	fanout_put(f, block);
+}
+
+// Read one period and publish it. If the device overruns, it is
+// prepared (reading starts it again) and the period is read again.
+// Return frames read or -1.
+static int
+fanout_read(struct fanout *f)
+{
+	struct fanout_block *block;
+	struct pcm_sync sync;
+	int index;
+
+	index = fanout_get_free_block(f);
+	if (index == -1)
+		f->overruns++;
+	block = &f->blocks[index == -1 ? f->n_blocks : index];
+
+	while ((block->frames = pcm_read(f->fd, block->data,
+	                                 f->period_size)) == -1 &&
+	       errno == EPIPE) {
+		f->xruns++;
+		if (pcm_prepare(f->fd) == -1)
+			return -1;
+	}
+	if (block->frames <= 0)
+		return block->frames;
+
+	// appl_ptr is now just after the block
+	if (pcm_sync(f->fd, &sync, 0) == -1)
+		return -1;
+	block->position = sync.control.appl_ptr - block->frames;
+	fanout_tstamp(f, &sync, block->position, &block->tstamp);
+
+	if (index != -1)
+		fanout_publish(f, index);
+
+	return block->frames;
+}
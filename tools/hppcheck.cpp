@@ -0,0 +1,61 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Compile test of nanoalsa.hpp: instantiate every stream type and call
+// each transfer with the buffer types applications pass. Nothing is run
+// (see hppcheck in Makefile).
+
+#include <vector>
+
+#include "nanoalsa.hpp"
+
+using namespace nanoalsa;
+
+#define STREAMS(format) \
+	template class nanoalsa::Stream<format, 1>; \
+	template class nanoalsa::Stream<format, 2>; \
+	template class nanoalsa::Stream<format, 1, PCM_ACCESS_RW_SCATTERED>; \
+	template class nanoalsa::Stream<format, 2, PCM_ACCESS_RW_SCATTERED>
+
+STREAMS(PCM_FORMAT_S8);
+STREAMS(PCM_FORMAT_U8);
+STREAMS(PCM_FORMAT_S16_LE);
+STREAMS(PCM_FORMAT_S16_BE);
+STREAMS(PCM_FORMAT_U16_LE);
+STREAMS(PCM_FORMAT_U16_BE);
+STREAMS(PCM_FORMAT_S32_LE);
+STREAMS(PCM_FORMAT_S32_BE);
+STREAMS(PCM_FORMAT_U32_LE);
+STREAMS(PCM_FORMAT_U32_BE);
+
+template <pcm_format_t Format>
+void
+transfers(Device &&device, const pcm_params_t &params)
+{
+	using interleaved = Stream<Format, 2>;
+	using scattered = Stream<Format, 2, PCM_ACCESS_RW_SCATTERED>;
+	using sample_type = typename interleaved::sample_type;
+
+	std::vector<sample_type> samples(64), left(32), right(32);
+	const std::vector<sample_type> &const_samples = samples;
+
+	interleaved s(std::move(device), params);
+	s.write(samples);
+	s.write(const_samples);
+	s.write(std::span<sample_type>(samples));
+	s.write(std::span<const sample_type>(samples));
+	s.read(samples);
+
+	scattered n(Device(-1), params);
+	n.write(typename scattered::buffer{left, right});
+	n.write(typename scattered::const_buffer{left, right});
+	n.read({left, right});
+}
+
+template void transfers<PCM_FORMAT_S16_LE>(Device &&, const pcm_params_t &);
+template void transfers<PCM_FORMAT_S16_BE>(Device &&, const pcm_params_t &);
+template void transfers<PCM_FORMAT_U8>(Device &&, const pcm_params_t &);
+template void transfers<PCM_FORMAT_S32_BE>(Device &&, const pcm_params_t &);
@@ -0,0 +1,257 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Buffer sound from a producer that delivers it in bursts or with
+// jitter (e.g. a decoder or a network stream on a pipe) before it goes
+// to the sound device.
+//
+// The producer is read whenever it has data (nonblocking), and the
+// device takes a period when it has room. Between them, a ring keeps a
+// fill level that covers the longest time the producer was seen to be
+// silent: at each arrival, the frames the device consumed since the
+// previous arrival are taken as a gap, and the target level is the
+// largest recent gap (it decays with a time constant of JITTER_DECAY
+// seconds) plus one period.
+//
+// The fill level is held at the target by playing slightly faster or
+// slower (at most JITTER_MAX_STRETCH): frames are taken from the ring at
+// a fractional step and linearly interpolated. So a producer that
+// delivers less or more than the device consumes (e.g. another clock)
+// does not make the device underrun, nor does latency grow. If the ring
+// runs out anyway, the missing frames are played as silence.
+//
+// Samples are little-endian: unsigned 8-bit, signed 16-bit or signed
+// 32-bit, as in wave files.
+
+#include <errno.h>    // errno, EAGAIN
+#include <math.h>     // exp()
+#include <stdint.h>   // int16_t, int32_t, int64_t, uint8_t
+#include <stdlib.h>   // malloc(), free()
+#include <string.h>   // memcpy(), memset()
+#include <time.h>     // clock_gettime()
+#include <unistd.h>   // read()
+
+// seconds for the target to decay to about a third
+#define JITTER_DECAY 10.0
+
+// largest deviation of speed from the nominal one
+#define JITTER_MAX_STRETCH 0.005
+
+struct jitter {
+	unsigned int rate;
+	int bytes;       // per sample
+	int channels;
+	int frame_bytes;
+
+	char *ring;
+	long size;       // bytes (whole frames)
+	long head, tail; // bytes written and read, since the start
+
+	double pos;      // read position between tail and the next frame
+	double ratio;    // frames taken per frame played
+	double peak;     // largest recent gap (frames)
+	double target;   // fill level (frames)
+	long period;     // frames the device takes at a time
+
+	struct timespec last; // last arrival
+	unsigned long concealed; // frames played as silence
+};
+
+static inline double
+jitter_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// `frames` is the size of the ring, `period` the frames written to the
+// device at a time
+static int
+jitter_init(struct jitter *j, unsigned int rate, int channels, int bytes,
+            long frames, long period)
+{
+	if (bytes != 1 && bytes != 2 && bytes != 4)
+		return -1;
+
+	memset(j, 0, sizeof(*j));
+	j->rate = rate;
+	j->bytes = bytes;
+	j->channels = channels;
+	j->frame_bytes = bytes * channels;
+	j->size = frames * j->frame_bytes;
+	j->period = period;
+	j->ratio = 1;
+	j->target = period;
+
+	j->ring = malloc(j->size);
+	return j->ring ? 0 : -1;
+}
+
+static void
+jitter_destroy(struct jitter *j)
+{
+	free(j->ring);
+}
+
+// Frames in the ring (a partial frame is not counted)
+static inline long
+jitter_level(struct jitter *j)
+{
+	return (j->head - j->tail) / j->frame_bytes;
+}
+
+static inline int
+jitter_full(struct jitter *j)
+{
+	return j->head - j->tail == j->size;
+}
+
+static void
+jitter_arrival(struct jitter *j)
+{
+	double now = jitter_now(), last, gap;
+
+	last = j->last.tv_sec + j->last.tv_nsec / 1e9;
+	clock_gettime(CLOCK_MONOTONIC, &j->last);
+	if (!last)
+		return;
+
+	gap = (now - last) * j->rate;
+	j->peak *= exp(-(now - last) / JITTER_DECAY);
+	if (gap > j->peak)
+		j->peak = gap;
+
+	j->target = j->peak + j->period;
+	if (j->target > j->size / j->frame_bytes - j->period)
+		j->target = j->size / j->frame_bytes - j->period;
+}
+
+// Read from `fd` (nonblocking) while it has data and the ring has room.
+// Return bytes read, 0 on end of file, or -1 on error (errno is EAGAIN
+// if there was no data).
+static long
+jitter_fill(struct jitter *j, int fd)
+{
+	long offset, room, total = 0, n;
+
+	if (jitter_full(j)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	while (!jitter_full(j)) {
+		offset = j->head % j->size;
+		room = j->size - (j->head - j->tail);
+		if (room > j->size - offset)
+			room = j->size - offset;
+
+		n = read(fd, j->ring + offset, room);
+		if (n <= 0) {
+			if (total && (n == 0 || errno == EAGAIN))
+				break;
+			return n;
+		}
+		j->head += n;
+		total += n;
+	}
+
+	jitter_arrival(j);
+	return total;
+}
+
+static inline int32_t
+jitter_load(struct jitter *j, long frame, int channel)
+{
+	const char *p = j->ring + (j->tail + frame * j->frame_bytes) % j->size +
+	                channel * j->bytes;
+	int16_t v16;
+	int32_t v32;
+
+	switch (j->bytes) {
+	case 1:  return (int32_t) *(const uint8_t*) p - 128;
+	case 2:  memcpy(&v16, p, 2); return v16;
+	default: memcpy(&v32, p, 4); return v32;
+	}
+}
+
+static inline void
+jitter_store(struct jitter *j, char *p, int64_t v)
+{
+	int16_t v16 = v;
+	int32_t v32 = v;
+
+	switch (j->bytes) {
+	case 1:  *(uint8_t*) p = v + 128; break;
+	case 2:  memcpy(p, &v16, 2); break;
+	default: memcpy(p, &v32, 4); break;
+	}
+}
+
+// Adjust speed to the distance from the target level
+static void
+jitter_update_ratio(struct jitter *j)
+{
+	double error = (jitter_level(j) - j->target) / j->target;
+	double ratio = 1 + error * JITTER_MAX_STRETCH;
+
+	if (ratio > 1 + JITTER_MAX_STRETCH)
+		ratio = 1 + JITTER_MAX_STRETCH;
+	else if (ratio < 1 - JITTER_MAX_STRETCH)
+		ratio = 1 - JITTER_MAX_STRETCH;
+
+	// smooth it, as the level moves by whole periods
+	j->ratio += (ratio - j->ratio) / 8;
+}
+
+// Put `frames` frames in `out`. With `conceal`, frames missing in the
+// ring are silence and speed follows the target level; otherwise, what
+// is in the ring is returned at nominal speed (e.g. at end of file).
+// Return frames put.
+static int
+jitter_get(struct jitter *j, void *out, int frames, int conceal)
+{
+	char *p = out;
+	long level = jitter_level(j), i;
+	int64_t a, b, frac;
+	int k, c;
+
+	if (conceal)
+		jitter_update_ratio(j);
+	else
+		j->ratio = 1;
+
+	for (k = 0; k < frames; k++, p += j->frame_bytes) {
+		i = (long) j->pos;
+		if (i >= level)
+			break;
+
+		// the last frame in the ring is taken as is
+		frac = (j->pos - i) * 65536;
+		for (c = 0; c < j->channels; c++) {
+			a = jitter_load(j, i, c);
+			b = i + 1 < level ? jitter_load(j, i + 1, c) : a;
+			jitter_store(j, p + c * j->bytes, a + ((b - a) * frac >> 16));
+		}
+		j->pos += j->ratio;
+	}
+
+	// advance over whole frames taken
+	i = (long) j->pos;
+	if (i > level)
+		i = level;
+	j->tail += i * j->frame_bytes;
+	j->pos -= i;
+
+	if (!conceal || k == frames)
+		return k;
+
+	// ring ran out
+	memset(p, j->bytes == 1 ? 0x80 : 0, (frames - k) * j->frame_bytes);
+	j->concealed += frames - k;
+
+	return frames;
+}
@@ -0,0 +1,450 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Measure round-trip latency and wakeup jitter for a list of period and
+// buffer sizes.
+//
+// Playback and capture devices are linked and started together. Every
+// quarter of a second, a maximum length sequence (MLS) is written to
+// playback. It is found in capture by cross-correlation (an MLS has a
+// single sharp correlation peak, even with noise and low level).
+//
+// For each period/buffer pair, it reports:
+//
+// - hw: frames between the position the MLS was written at and the
+//   position it was captured at (converter and FIFO delays).
+// - round trip: time between writing the MLS and capturing it, i.e. hw
+//   plus the playback buffer fill plus capture granularity. It is what
+//   an application that plays what it captures gets.
+// - jitter: deviation of the time between capture wakeups from the
+//   period time.
+//
+// Without hardware (or with -e), an emulated loopback is used: capture
+// returns what was written to playback, `-d` frames later, at the pace
+// of the clock.
+//
+// E.g.: ./latency -c 0 -p 64:256,128:512,256:1024
+//       ./latency -c 1 -D 0:1 (snd-aloop: what device 0 plays, device 1
+//                              captures)
+//       ./latency -e -d 100
+
+#include <errno.h>  // errno
+#include <math.h>   // sqrt()
+#include <stdint.h> // int16_t
+#include <stdio.h>  // printf(), perror()
+#include <stdlib.h> // calloc(), free(), strtol()
+#include <string.h> // memset(), memcpy(), strerror()
+#include <time.h>   // clock_gettime(), clock_nanosleep()
+#include <unistd.h> // getopt(), close()
+
+#include "nanoalsa.h"
+
+#define CHANNELS 2
+#define MLS_ORDER 10
+#define MLS_LENGTH ((1 << MLS_ORDER) - 1)
+#define AMPLITUDE 8000
+
+// seconds of each measurement, and interval between MLS emissions
+#define DURATION 3
+#define INTERVAL_DIV 4
+
+// MLS from a linear feedback shift register (x^10 + x^7 + 1)
+static void
+mls_generate(int16_t *mls)
+{
+	unsigned int lfsr = 1, bit;
+	int i;
+
+	for (i = 0; i < MLS_LENGTH; i++) {
+		mls[i] = lfsr & 1 ? AMPLITUDE : -AMPLITUDE;
+		bit = (lfsr ^ lfsr >> 3) & 1;
+		lfsr = lfsr >> 1 | bit << (MLS_ORDER - 1);
+	}
+}
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Loopback
+// ========================================================================
+
+struct loopback {
+	int emulate;
+	int play_fd, capture_fd;
+
+	// emulation
+	int16_t *played;  // all frames written (channel 0)
+	long size;        // frames `played` holds
+	long written;     // frames written
+	long captured;    // frames read
+	long delay;       // frames between playback and capture
+	double start;
+	unsigned int rate;
+};
+
+static int
+loopback_setup(struct loopback *l, int card, int play_device,
+               int capture_device, unsigned int rate, int period, int buffer)
+{
+	pcm_params_t params;
+	int i, fds[2];
+
+	l->rate = rate;
+	l->written = l->captured = 0;
+	if (l->emulate) {
+		// what measure() writes: the prefill and one period per period
+		// captured
+		l->size = (long) rate * DURATION + buffer + period;
+		l->played = calloc(l->size, sizeof(int16_t));
+		return l->played ? 0 : -1;
+	}
+
+	fds[0] = l->play_fd    = pcm_open(card, play_device, PCM_OUTPUT);
+	fds[1] = l->capture_fd = pcm_open(card, capture_device, PCM_INPUT);
+	if (l->play_fd == -1 || l->capture_fd == -1)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		pcm_params_init(&params);
+		pcm_set(&params, PCM_ACCESS,      PCM_ACCESS_RW);
+		pcm_set(&params, PCM_FORMAT,      PCM_FORMAT_S16_LE);
+		pcm_set(&params, PCM_RATE,        rate);
+		pcm_set(&params, PCM_CHANNELS,    CHANNELS);
+		pcm_set(&params, PCM_PERIOD_SIZE, period);
+		pcm_set(&params, PCM_BUFFER_SIZE, buffer);
+		// started by pcm_start() (see loopback_start())
+		pcm_set(&params, PCM_START_THRESHOLD, buffer * 2);
+		if (pcm_params_setup(fds[i], &params) == -1)
+			return -1;
+	}
+
+	return pcm_link(l->play_fd, l->capture_fd);
+}
+
+// `set_up` is zero after a failed loopback_setup()
+static void
+loopback_close(struct loopback *l, int set_up)
+{
+	if (l->emulate) {
+		free(l->played);
+		return;
+	}
+	if (set_up) {
+		pcm_stop(l->play_fd);
+		pcm_unlink(l->play_fd);
+	}
+	if (l->play_fd != -1)
+		close(l->play_fd);
+	if (l->capture_fd != -1)
+		close(l->capture_fd);
+}
+
+static int
+loopback_write(struct loopback *l, int16_t *buf, int frames)
+{
+	int i;
+
+	if (!l->emulate)
+		return pcm_write(l->play_fd, buf, frames);
+
+	if (frames > l->size - l->written)
+		frames = l->size - l->written;
+	for (i = 0; i < frames; i++)
+		l->played[l->written + i] = buf[i * CHANNELS];
+	l->written += frames;
+
+	return frames;
+}
+
+static int
+loopback_start(struct loopback *l)
+{
+	l->start = now();
+	return l->emulate ? 0 : pcm_start(l->play_fd);
+}
+
+// Emulated capture waits for the frames to be "recorded", then copies
+// from playback what was written `delay` frames before.
+static int
+loopback_read(struct loopback *l, int16_t *buf, int frames)
+{
+	struct timespec ts;
+	double until;
+	long i, p;
+
+	if (!l->emulate)
+		return pcm_read(l->capture_fd, buf, frames);
+
+	until = l->start + (double) (l->captured + frames) / l->rate;
+	ts.tv_sec = until;
+	ts.tv_nsec = (until - ts.tv_sec) * 1e9;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+	for (i = 0; i < frames; i++) {
+		p = l->captured + i - l->delay;
+		buf[i * CHANNELS] = buf[i * CHANNELS + 1] =
+			p >= 0 && p < l->written ? l->played[p] : 0;
+	}
+	l->captured += frames;
+
+	return frames;
+}
+
+// Measurement
+// ========================================================================
+
+struct emission {
+	long position; // playback position the MLS was written at
+	long read;     // frames captured at the time it was written
+};
+
+struct result {
+	double hw, hw_var;   // frames
+	double rt, rt_var;   // frames
+	double jitter, jitter_max; // seconds
+	int found, emitted;
+};
+
+// Find the lag (from `from`, up to `range` frames) with the highest
+// correlation between capture and the MLS.
+static long
+find_mls(int16_t *capture, long length, int16_t *mls, long from, long range)
+{
+	long lag, best = -1, i;
+	double sum, best_sum = 0;
+
+	for (lag = from; lag < from + range && lag + MLS_LENGTH <= length; lag++) {
+		sum = 0;
+		for (i = 0; i < MLS_LENGTH; i++)
+			sum += (double) capture[lag + i] * mls[i];
+		if (sum > best_sum) {
+			best_sum = sum;
+			best = lag;
+		}
+	}
+
+	// a peak is at least half of the energy of the MLS at 1/4 level
+	if (best_sum < (double) MLS_LENGTH * AMPLITUDE * AMPLITUDE / 8)
+		return -1;
+
+	return best;
+}
+
+// Buffers of a measurement
+struct recording {
+	int16_t *out, *in;
+	int16_t *capture; // all frames captured (channel 0)
+	long read;        // frames captured
+	double *wakeups;  // time of each capture wakeup
+	int n_wakeups;
+	struct emission emissions[DURATION * INTERVAL_DIV];
+	int n_emissions;
+};
+
+// Play the MLS every interval while capturing for DURATION seconds
+static int
+record(struct loopback *l, int period, int buffer, int16_t *mls,
+       struct recording *rec)
+{
+	long total = (long) l->rate * DURATION, interval = l->rate / INTERVAL_DIV;
+	long written = 0, next_emit = interval, mls_pos = -1, i;
+	int frames;
+
+	// prefill playback with silence
+	while (written < buffer)
+		written += loopback_write(l, rec->out, period);
+	if (loopback_start(l) == -1)
+		return -1;
+
+	while (rec->read + period <= total) {
+		frames = loopback_read(l, rec->in, period);
+		if (frames <= 0)
+			return -1;
+		rec->wakeups[rec->n_wakeups++] = now();
+		for (i = 0; i < frames; i++)
+			rec->capture[rec->read + i] = rec->in[i * CHANNELS];
+		rec->read += frames;
+
+		// next period of playback: MLS or silence
+		if (mls_pos < 0 && written >= next_emit &&
+		    rec->n_emissions < DURATION * INTERVAL_DIV) {
+			rec->emissions[rec->n_emissions].position = written;
+			rec->emissions[rec->n_emissions++].read = rec->read;
+			next_emit += interval;
+			mls_pos = 0;
+		}
+		for (i = 0; i < period; i++, mls_pos += mls_pos >= 0) {
+			if (mls_pos >= MLS_LENGTH)
+				mls_pos = -1;
+			rec->out[i * CHANNELS] = rec->out[i * CHANNELS + 1] =
+				mls_pos >= 0 ? mls[mls_pos] : 0;
+		}
+		if (loopback_write(l, rec->out, period) <= 0)
+			return -1;
+		written += period;
+	}
+
+	return 0;
+}
+
+// Find the emissions in the recording and measure the wakeups
+static void
+analyze(struct loopback *l, int period, int16_t *mls, struct recording *rec,
+        struct result *r)
+{
+	struct emission *e;
+	double t, d;
+	long lag;
+	int k;
+
+	memset(r, 0, sizeof(*r));
+	r->emitted = rec->n_emissions;
+	// hardware delay is assumed below 100 ms
+	for (k = 0; k < rec->n_emissions; k++) {
+		e = &rec->emissions[k];
+		lag = find_mls(rec->capture, rec->read, mls, e->position,
+		               l->rate / 10);
+		if (lag == -1)
+			continue;
+		r->hw += lag - e->position;
+		r->hw_var += (double) (lag - e->position) * (lag - e->position);
+		r->rt += lag - e->read;
+		r->rt_var += (double) (lag - e->read) * (lag - e->read);
+		r->found++;
+	}
+	if (r->found) {
+		r->hw /= r->found;
+		r->rt /= r->found;
+		r->hw_var = r->hw_var / r->found - r->hw * r->hw;
+		r->rt_var = r->rt_var / r->found - r->rt * r->rt;
+	}
+
+	// the first wakeups are at once (buffer was prefilled)
+	t = (double) period / l->rate;
+	for (k = 2; k < rec->n_wakeups; k++) {
+		d = rec->wakeups[k] - rec->wakeups[k - 1] - t;
+		r->jitter += d * d;
+		if (fabs(d) > r->jitter_max)
+			r->jitter_max = fabs(d);
+	}
+	if (rec->n_wakeups > 2)
+		r->jitter = sqrt(r->jitter / (rec->n_wakeups - 2));
+}
+
+static int
+measure(struct loopback *l, int period, int buffer, int16_t *mls,
+        struct result *r)
+{
+	long total = (long) l->rate * DURATION;
+	struct recording rec = {0};
+	int ret = -1;
+
+	rec.out = calloc(period * CHANNELS, sizeof(int16_t));
+	rec.in = calloc(period * CHANNELS, sizeof(int16_t));
+	rec.capture = calloc(total + period, sizeof(int16_t));
+	rec.wakeups = calloc(total / period + 1, sizeof(double));
+	if (rec.out && rec.in && rec.capture && rec.wakeups)
+		ret = record(l, period, buffer, mls, &rec);
+	if (ret == 0)
+		analyze(l, period, mls, &rec, r);
+
+	free(rec.out);
+	free(rec.in);
+	free(rec.capture);
+	free(rec.wakeups);
+
+	return ret;
+}
+
+static const char *usage =
+"usage: latency [-c card] [-D play[:capture]] [-r rate]\n"
+"               [-p period:buffer,...] [-e] [-d emulated_delay]\n"
+"Default: card 0, devices 0:0 (capture is play if not given), rate 48000,\n"
+"         -p 64:256,128:512,256:1024,1024:4096\n"
+"-e uses an emulated loopback (also used if the device can not be opened)\n";
+
+int
+main(int argc, char **argv)
+{
+	char *sizes = "64:256,128:512,256:1024,1024:4096", *p;
+	int card = 0, play_device = 0, capture_device = -1, period, buffer, opt;
+	int opened, measured = 0;
+	unsigned int rate = 48000;
+	struct loopback l = {.delay = 64};
+	int16_t mls[MLS_LENGTH];
+	struct result r;
+
+	while ((opt = getopt(argc, argv, "c:D:r:p:ed:")) != -1) {
+		switch (opt) {
+		case 'c': card = atoi(optarg); break;
+		case 'D':
+			sscanf(optarg, "%d:%d", &play_device, &capture_device);
+			break;
+		case 'r': rate = atoi(optarg); break;
+		case 'p': sizes = optarg; break;
+		case 'e': l.emulate = 1; break;
+		case 'd': l.delay = atol(optarg); break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+
+	if (capture_device == -1)
+		capture_device = play_device;
+
+	mls_generate(mls);
+
+	printf("period buffer | hw (frames)  | round trip (ms) | jitter (ms) "
+	       "| found\n");
+	p = sizes;
+	while (sscanf(p, "%d:%d", &period, &buffer) == 2) {
+		if (loopback_setup(&l, card, play_device, capture_device, rate,
+		                   period, buffer) == -1) {
+			if (l.emulate) {
+				perror("loopback");
+				return 1;
+			}
+			// Without a device, all rows are emulated. A pair the
+			// device does not take is skipped.
+			opened = l.play_fd != -1 && l.capture_fd != -1;
+			if (opened || measured)
+				fprintf(stderr, "%d:%d: %s\n", period, buffer,
+				        strerror(errno));
+			else
+				perror("Using emulated loopback");
+			loopback_close(&l, 0);
+			if (!opened && !measured) {
+				l.emulate = 1;
+				continue;
+			}
+		} else if (measure(&l, period, buffer, mls, &r) == -1) {
+			perror("measure");
+			loopback_close(&l, 1);
+		} else {
+			printf("%6d %6d | %5.0f +- %-4.1f | %6.2f +- %-6.3f | "
+			       "%.3f (max %.3f) | %d/%d%s\n", period, buffer,
+			       r.hw, sqrt(r.hw_var),
+			       r.rt * 1000 / rate, sqrt(r.rt_var) * 1000 / rate,
+			       r.jitter * 1000, r.jitter_max * 1000,
+			       r.found, r.emitted, l.emulate ? " (emulated)" : "");
+			measured = 1;
+			loopback_close(&l, 1);
+		}
+
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
+	}
+
+	return 0;
+}
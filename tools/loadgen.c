@@ -0,0 +1,598 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Drive many streams of generated signals (see siggen.h) through
+// playback-to-capture loopbacks, and check that every captured frame is
+// the one played: dropped, duplicated and corrupt frames are counted.
+// Meant for soak and scaling tests, so nothing touches the disk.
+//
+// Streams are shared among one worker thread per CPU (see engine.h).
+// Each stream is woken when a period was captured: it checks it and
+// plays the next period, with pcm_write() or (-m) by rendering in the
+// mmapped playback buffer and forwarding the application position.
+//
+// Playback and capture are devices `-D play:capture` of card `-c`, e.g.
+// 0:1 for the ALSA loopback driver (snd-aloop), and are linked. Streams
+// take substreams in order, so stream n plays to and captures from
+// substream n.
+//
+// Without hardware (or with -e), each stream has an emulated loopback:
+// a timer at the period pace (or no pacing at all with -u, to measure
+// the throughput of generating and checking), and a ring where capture
+// gets what was played `-d` (at least 1) frames before. `-x` makes the
+// emulated capture alternately duplicate and drop a frame every that
+// many frames.
+//
+// The rate (-r) is per stream; -A sets it so that all streams together
+// run at the given rate. An emulated stream falls into an underrun when
+// it is late by its whole buffer; then it restarts, as a device stream
+// does, and its checker locks on the signal again.
+//
+// Every second, the frames checked per second and the load of each
+// worker are printed. Exit status is 1 if any frame was wrong or a
+// stream never locked on its signal.
+//
+// E.g.: ./loadgen -n 8 -c 1 -D 0:1 -f S32_LE -C 8 -t 3600
+//       ./loadgen -e -n 64 -A 10000000 -x 100000
+//       ./loadgen -e -u -n 16 -s sine
+
+#define _GNU_SOURCE // pthread_setaffinity_np()
+
+#include <errno.h>       // errno
+#include <signal.h>      // signal()
+#include <stdint.h>      // uint8_t, uint64_t
+#include <stdio.h>       // printf(), perror()
+#include <stdlib.h>      // atoi(), calloc()
+#include <string.h>      // strerror()
+#include <strings.h>     // strcasecmp()
+#include <sys/eventfd.h> // eventfd()
+#include <sys/mman.h>    // mmap()
+#include <sys/timerfd.h> // timerfd_create()
+#include <unistd.h>      // getopt(), sleep(), close()
+
+#include "nanoalsa.h"
+#include "engine.h"
+#include "siggen.h"
+
+#define PERIODS 4
+
+static volatile sig_atomic_t        keep_running = 1;
+static void on_sigint(int signum) { keep_running = 0; }
+
+static struct {
+	int type;
+	pcm_format_t format;
+	int channels;
+	unsigned int rate;
+	int period;
+	int mmap;
+	int card, play_device, capture_device;
+
+	int emulate;
+	int unpaced;
+	long delay;
+	long fault;
+} cfg = {
+	.type = SIGGEN_NOISE, .format = PCM_FORMAT_S16_LE, .channels = 2,
+	.rate = 48000, .period = 480, .card = 0, .play_device = 0,
+	.capture_device = 1, .delay = 64,
+};
+
+static const struct {
+	const char *name;
+	pcm_format_t format;
+} formats[] = {
+	{ "S8",     PCM_FORMAT_S8     }, { "U8",     PCM_FORMAT_U8     },
+	{ "S16_LE", PCM_FORMAT_S16_LE }, { "S16_BE", PCM_FORMAT_S16_BE },
+	{ "U16_LE", PCM_FORMAT_U16_LE }, { "U16_BE", PCM_FORMAT_U16_BE },
+	{ "S32_LE", PCM_FORMAT_S32_LE }, { "S32_BE", PCM_FORMAT_S32_BE },
+	{ "U32_LE", PCM_FORMAT_U32_LE }, { "U32_BE", PCM_FORMAT_U32_BE },
+};
+
+struct stream {
+	struct engine_stream stream;
+	struct siggen gen;
+	struct siggen_check check;
+	uint64_t written; // frames of signal played
+	uint8_t *buffer;  // a period
+	unsigned long xruns;
+
+	// published for the status line
+	atomic_ulong checked, errors;
+
+	// device
+	int play_fd, capture_fd;
+	uint8_t *area;    // mmapped playback buffer
+	long buffer_size;
+
+	// emulation
+	int timer_fd;
+	uint8_t *ring;
+	long ring_size;   // frames
+	uint64_t head, tail, captured;
+	uint64_t fault_at;
+	int fault_dup;
+};
+
+static void
+stream_publish(struct stream *s)
+{
+	struct siggen_check *c = &s->check;
+
+	atomic_store_explicit(&s->checked, c->verified, memory_order_relaxed);
+	atomic_store_explicit(&s->errors, c->dropped + c->duplicated +
+	                      c->corrupt, memory_order_relaxed);
+}
+
+// Not served by the engine (it is full), or removed from it on error:
+// its fds are closed by stream_close() at the end, and it counts as not
+// locked
+static void
+stream_drop(struct engine_stream *stream, int error)
+{
+	fprintf(stderr, "Stream dropped: %s\n", strerror(error));
+}
+
+// Emulated loopback
+// ========================================================================
+
+// Copy `n` frames from the ring at frame `pos`
+static void
+ring_read(struct stream *s, uint8_t *out, uint64_t pos, long n)
+{
+	int fb = s->gen.frame_bytes;
+	long offset = pos % s->ring_size, first;
+
+	first = n < s->ring_size - offset ? n : s->ring_size - offset;
+	memcpy(out, s->ring + offset * fb, first * fb);
+	memcpy(out + first * fb, s->ring, (n - first) * fb);
+}
+
+// Copy `n` frames to the ring at frame `pos`
+static void
+ring_write(struct stream *s, uint8_t *in, uint64_t pos, long n)
+{
+	int fb = s->gen.frame_bytes;
+	long offset = pos % s->ring_size, first;
+
+	first = n < s->ring_size - offset ? n : s->ring_size - offset;
+	memcpy(s->ring + offset * fb, in, first * fb);
+	memcpy(s->ring, in + first * fb, (n - first) * fb);
+}
+
+static void
+emu_capture(struct stream *s, uint8_t *out)
+{
+	int fb = s->gen.frame_bytes, done = 0;
+	long n;
+
+	while (done < cfg.period) {
+		n = cfg.period - done;
+		if (cfg.fault && s->fault_at - s->captured < (uint64_t) n)
+			n = s->fault_at - s->captured;
+		if (!n) {
+			// repeat the last frame captured, or skip the next one
+			s->fault_dup ^= 1;
+			s->tail += s->fault_dup ? -1 : 1;
+			s->fault_at += cfg.fault;
+			continue;
+		}
+		ring_read(s, out + done * fb, s->tail, n);
+		s->tail += n;
+		s->captured += n;
+		done += n;
+	}
+}
+
+// Render a period directly in the ring (-m), or copy it from `buffer`
+static void
+emu_play(struct stream *s)
+{
+	long offset = s->head % s->ring_size, first;
+	int fb = s->gen.frame_bytes;
+
+	if (!cfg.mmap) {
+		siggen_render(&s->gen, s->buffer, s->written, cfg.period);
+		ring_write(s, s->buffer, s->head, cfg.period);
+	} else {
+		first = cfg.period < s->ring_size - offset ?
+		        cfg.period : s->ring_size - offset;
+		siggen_render(&s->gen, s->ring + offset * fb, s->written, first);
+		siggen_render(&s->gen, s->ring, s->written + first,
+		              cfg.period - first);
+	}
+
+	s->head += cfg.period;
+	s->written += cfg.period;
+}
+
+// Fill the ring with `delay` frames of silence and start the timer
+static int
+emu_start(struct stream *s)
+{
+	struct itimerspec its = {0};
+	long period_ns = cfg.period * 1000000000L / cfg.rate;
+
+	siggen_silence(&s->gen, s->ring, s->ring_size);
+	s->tail = s->captured = s->written = 0;
+	s->head = cfg.delay;
+	s->fault_at = cfg.fault;
+	s->fault_dup = 0;
+
+	if (cfg.unpaced)
+		return 0;
+
+	its.it_value.tv_nsec = its.it_interval.tv_nsec = period_ns % 1000000000L;
+	its.it_value.tv_sec = its.it_interval.tv_sec = period_ns / 1000000000L;
+	return timerfd_settime(s->timer_fd, 0, &its, NULL);
+}
+
+static int
+emu_process(struct engine_stream *stream)
+{
+	struct stream *s = (struct stream*) stream;
+	uint64_t periods = 1;
+
+	// without pacing, the eventfd is always ready
+	if (!cfg.unpaced && read(s->timer_fd, &periods, sizeof(periods)) == -1)
+		return errno == EAGAIN ? 0 : -1;
+
+	if (periods >= PERIODS) {
+		s->xruns++;
+		siggen_check_reset(&s->check);
+		return emu_start(s) == -1 ? -1 : 0;
+	}
+
+	while (periods--) {
+		emu_play(s);
+		emu_capture(s, s->buffer);
+		siggen_check_push(&s->check, s->buffer, cfg.period);
+	}
+	stream_publish(s);
+
+	return 0;
+}
+
+static int
+emu_open(struct stream *s)
+{
+	s->ring_size = cfg.delay + cfg.period + 2;
+	s->ring = malloc(s->ring_size * s->gen.frame_bytes);
+	if (!s->ring)
+		return -1;
+
+	if (cfg.unpaced)
+		s->timer_fd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+	else
+		s->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+		                             TFD_CLOEXEC | TFD_NONBLOCK);
+	if (s->timer_fd == -1)
+		return -1;
+
+	s->stream.fd = s->timer_fd;
+	s->stream.process = emu_process;
+	s->stream.drop = stream_drop;
+
+	return emu_start(s);
+}
+
+// Device loopback
+// ========================================================================
+
+static int
+dev_play(struct stream *s, int frames)
+{
+	long offset, first;
+	int fb = s->gen.frame_bytes, n;
+
+	if (!cfg.mmap) {
+		siggen_render(&s->gen, s->buffer, s->written, frames);
+		n = pcm_write(s->play_fd, s->buffer, frames);
+	} else {
+		offset = s->written % s->buffer_size;
+		first = frames < s->buffer_size - offset ?
+		        frames : s->buffer_size - offset;
+		siggen_render(&s->gen, s->area + offset * fb, s->written, first);
+		siggen_render(&s->gen, s->area, s->written + first, frames - first);
+		n = pcm_move_app_pos(s->play_fd, frames);
+	}
+
+	if (n > 0)
+		s->written += n;
+	return n;
+}
+
+// Prepare both (they are linked), fill the playback buffer and start.
+// It is filled a period at a time, as s->buffer holds one period.
+static int
+dev_start(struct stream *s)
+{
+	long frames;
+
+	s->written = 0;
+	if (pcm_prepare(s->play_fd) == -1)
+		return -1;
+
+	while ((long) s->written < s->buffer_size) {
+		frames = s->buffer_size - s->written;
+		if (frames > cfg.period)
+			frames = cfg.period;
+		if (dev_play(s, frames) != frames)
+			return -1;
+	}
+
+	return pcm_start(s->play_fd);
+}
+
+static int
+dev_restart(struct stream *s)
+{
+	s->xruns++;
+	siggen_check_reset(&s->check);
+	pcm_stop(s->play_fd);
+
+	return dev_start(s);
+}
+
+static int
+dev_process(struct engine_stream *stream)
+{
+	struct stream *s = (struct stream*) stream;
+	int n;
+
+	n = pcm_read(s->capture_fd, s->buffer, cfg.period);
+	if (n == -1 && errno == EAGAIN)
+		return 0;
+	if (n == -1)
+		return errno == EPIPE ? dev_restart(s) : -1;
+
+	siggen_check_push(&s->check, s->buffer, n);
+	stream_publish(s);
+
+	n = dev_play(s, n);
+	if (n == -1 && errno != EAGAIN)
+		return errno == EPIPE ? dev_restart(s) : -1;
+
+	return 0;
+}
+
+static int
+dev_setup(int fd, pcm_access_t access, pcm_params_t *params)
+{
+	pcm_params_init(params);
+	pcm_set(params, PCM_ACCESS,      access);
+	pcm_set(params, PCM_FORMAT,      cfg.format);
+	pcm_set(params, PCM_CHANNELS,    cfg.channels);
+	pcm_set(params, PCM_RATE,        cfg.rate);
+	pcm_set(params, PCM_PERIOD_SIZE, cfg.period);
+	pcm_set(params, PCM_PERIODS,     PERIODS);
+	// started by pcm_start() (see dev_start())
+	pcm_set(params, PCM_START_THRESHOLD, cfg.period * PERIODS * 2);
+
+	return pcm_params_setup(fd, params);
+}
+
+static int
+dev_open(struct stream *s)
+{
+	pcm_params_t params;
+
+	s->play_fd = pcm_open(cfg.card, cfg.play_device,
+	                      PCM_OUTPUT | PCM_NONBLOCK);
+	s->capture_fd = pcm_open(cfg.card, cfg.capture_device,
+	                         PCM_INPUT | PCM_NONBLOCK);
+	if (s->play_fd == -1 || s->capture_fd == -1)
+		return -1;
+
+	if (dev_setup(s->capture_fd, PCM_ACCESS_RW, &params) == -1 ||
+	    dev_setup(s->play_fd, cfg.mmap ? PCM_ACCESS_MMAP : PCM_ACCESS_RW,
+	              &params) == -1 ||
+	    pcm_link(s->play_fd, s->capture_fd) == -1)
+		return -1;
+
+	s->buffer_size = pcm_get(&params, PCM_BUFFER_SIZE, 0);
+	if (cfg.mmap) {
+		s->area = mmap(NULL, s->buffer_size * s->gen.frame_bytes,
+		               PROT_READ | PROT_WRITE, MAP_SHARED, s->play_fd,
+		               SNDRV_PCM_MMAP_OFFSET_DATA);
+		if (s->area == MAP_FAILED)
+			return -1;
+	}
+
+	s->stream.fd = s->capture_fd;
+	s->stream.process = dev_process;
+	s->stream.drop = stream_drop;
+
+	return dev_start(s);
+}
+
+static void
+dev_close(struct stream *s)
+{
+	if (s->area && s->area != MAP_FAILED)
+		munmap(s->area, s->buffer_size * s->gen.frame_bytes);
+	if (s->play_fd > 0) {
+		pcm_stop(s->play_fd);
+		pcm_unlink(s->play_fd);
+		close(s->play_fd);
+	}
+	if (s->capture_fd > 0)
+		close(s->capture_fd);
+	s->area = NULL;
+	s->play_fd = s->capture_fd = -1;
+}
+
+// Streams
+// ========================================================================
+
+static int
+stream_open(struct stream *s, int index)
+{
+	if (siggen_init(&s->gen, cfg.type, cfg.format, cfg.channels, cfg.rate,
+	                index) == -1 ||
+	    siggen_check_init(&s->check, &s->gen, cfg.period) == -1)
+		return -1;
+
+	s->buffer = malloc(cfg.period * s->gen.frame_bytes);
+	if (!s->buffer)
+		return -1;
+
+	s->stream.events = EPOLLIN;
+	s->stream.period_ns = cfg.period * 1000000000L / cfg.rate;
+
+	return cfg.emulate ? emu_open(s) : dev_open(s);
+}
+
+static void
+stream_close(struct stream *s)
+{
+	if (cfg.emulate) {
+		if (s->timer_fd > 0)
+			close(s->timer_fd);
+		free(s->ring);
+	} else {
+		dev_close(s);
+	}
+	siggen_check_destroy(&s->check);
+	free(s->buffer);
+}
+
+static const char *usage =
+"usage: loadgen [-n streams] [-s signal] [-f format] [-C channels]\n"
+"               [-r rate | -A aggregate_rate] [-p period] [-m] [-t seconds]\n"
+"               [-w workers] [-c card] [-D play:capture]\n"
+"               [-e] [-u] [-d emulated_delay] [-x fault_interval]\n"
+"Default: 1 stream, noise, S16_LE, 2 channels, rate 48000, period 480,\n"
+"         10 seconds (0 is until interrupted), card 0, devices 0:1\n"
+"Signals: sine, sweep, noise, impulse\n"
+"Formats: S8, U8, {S,U}{16,32}_{LE,BE}\n"
+"-m plays through the mmapped buffer\n"
+"-e uses emulated loopbacks (also used if a device can not be opened)\n"
+"-u does not pace emulated loopbacks\n";
+
+int
+main(int argc, char **argv)
+{
+	struct engine engine;
+	struct stream *streams;
+	unsigned long checked, last = 0, errors, aggregate = 0, xruns = 0;
+	struct siggen_check total = {0};
+	int n_streams = 1, n_workers = 0, seconds = 10, opt, i, t, unlocked;
+	size_t f;
+
+	signal(SIGINT, on_sigint);
+
+	while ((opt = getopt(argc, argv, "n:s:f:C:r:A:p:mt:w:c:D:eud:x:")) != -1) {
+		switch (opt) {
+		case 'n': n_streams = atoi(optarg); break;
+		case 's': cfg.type = siggen_type(optarg); break;
+		case 'f':
+			cfg.format = -1;
+			for (f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+				if (!strcasecmp(optarg, formats[f].name))
+					cfg.format = formats[f].format;
+			}
+			break;
+		case 'C': cfg.channels = atoi(optarg); break;
+		case 'r': cfg.rate = atoi(optarg); break;
+		case 'A': aggregate = atol(optarg); break;
+		case 'p': cfg.period = atoi(optarg); break;
+		case 'm': cfg.mmap = 1; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'w': n_workers = atoi(optarg); break;
+		case 'c': cfg.card = atoi(optarg); break;
+		case 'D':
+			sscanf(optarg, "%d:%d", &cfg.play_device, &cfg.capture_device);
+			break;
+		case 'e': cfg.emulate = 1; break;
+		case 'u': cfg.unpaced = 1; break;
+		case 'd': cfg.delay = atol(optarg); break;
+		case 'x': cfg.fault = atol(optarg); break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (aggregate && n_streams > 0)
+		cfg.rate = aggregate / n_streams;
+	if (n_streams < 1 || cfg.type == -1 || (int) cfg.format == -1 ||
+	    cfg.channels < 1 || !cfg.rate || cfg.period < 1 || cfg.delay < 1 ||
+	    cfg.fault < 0) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	streams = calloc(n_streams, sizeof(*streams));
+	if (!streams || engine_start(&engine, n_workers) == -1) {
+		perror("Error while starting engine");
+		return 1;
+	}
+
+	for (i = 0; i < n_streams; i++) {
+		if (stream_open(&streams[i], i) == 0)
+			continue;
+		if (cfg.emulate) {
+			perror("Error while opening emulated stream");
+			return 1;
+		}
+
+		// no device: emulate all streams
+		perror("Using emulated loopbacks");
+		for (; i >= 0; i--)
+			stream_close(&streams[i]);
+		memset(streams, 0, n_streams * sizeof(*streams));
+		cfg.emulate = 1;
+	}
+
+	for (i = 0; i < n_streams; i++)
+		engine_add(&engine, &streams[i].stream);
+
+	printf("%d streams, %u Hz, %d channels: target %lu frames/s%s\n",
+	       n_streams, cfg.rate, cfg.channels,
+	       (unsigned long) cfg.rate * n_streams,
+	       cfg.unpaced ? " (unpaced)" : "");
+	for (t = 0; keep_running && (!seconds || t < seconds); t++) {
+		sleep(1);
+		checked = errors = 0;
+		for (i = 0; i < n_streams; i++) {
+			checked += atomic_load_explicit(&streams[i].checked,
+			                                memory_order_relaxed);
+			errors += atomic_load_explicit(&streams[i].errors,
+			                               memory_order_relaxed);
+		}
+		printf("%10lu frames/s %8.1f MB/s | %lu wrong |", checked - last,
+		       (double) (checked - last) * streams[0].gen.frame_bytes / 1e6,
+		       errors);
+		for (i = 0; i < engine.n_workers; i++) {
+			printf(" %5.1f%%", atomic_load(&engine.workers[i].load) *
+			       100.0 / ENGINE_LOAD_FULL);
+		}
+		putchar('\n');
+		last = checked;
+	}
+
+	engine_stop(&engine);
+
+	unlocked = 0;
+	for (i = 0; i < n_streams; i++) {
+		total.verified   += streams[i].check.verified;
+		total.skipped    += streams[i].check.skipped;
+		total.dropped    += streams[i].check.dropped;
+		total.duplicated += streams[i].check.duplicated;
+		total.corrupt    += streams[i].check.corrupt;
+		xruns            += streams[i].xruns;
+		unlocked += !streams[i].check.locked;
+		stream_close(&streams[i]);
+	}
+	free(streams);
+
+	printf("checked %lu, before lock %lu, dropped %lu, duplicated %lu, "
+	       "corrupt %lu, xruns %lu, streams not locked %d\n", total.verified,
+	       total.skipped, total.dropped, total.duplicated, total.corrupt,
+	       xruns, unlocked);
+
+	return total.dropped || total.duplicated || total.corrupt || unlocked;
+}
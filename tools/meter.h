@@ -0,0 +1,331 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Measure peak, RMS and clipping of each channel in blocks of captured
+// sound, and gate blocks that are silent.
+//
+// Samples of any pcm_format_t are first converted to signed 32-bit,
+// aligned to the most significant bit, so full scale is the same for all
+// formats. Then each channel is reduced to its maximum, minimum, sum of
+// squares and count of samples at full scale. Both loops have no
+// dependencies between iterations other than the reductions, and the
+// channel count is a constant for common layouts (1, 2, 4 and 8), so the
+// compiler can vectorize them. It does so at -O3 (fancap.o is built with
+// it, see tools/Makefile; check with -fopt-info-vec); other channel
+// counts take a scalar loop.
+//
+// Results of the last block go to a snapshot that any thread reads with
+// meter_read(), without locks and without blocking the writer (a
+// sequence lock: the writer makes the sequence odd while writing, and the
+// reader retries if it saw an odd or changed sequence).
+//
+// The gate opens when the RMS of any channel in a block is above the
+// threshold, and closes `hold` frames after the last block above it, so
+// that quiet ends of sounds are kept.
+
+#include <math.h>      // sqrt(), log10(), pow()
+#include <stdatomic.h> // atomic_*
+#include <stdint.h>    // int32_t, int64_t, uint16_t, uint32_t
+#include <string.h>    // memcpy(), memset()
+
+#include "nanoalsa.h"
+
+#define METER_MAX_CHANNELS 32
+
+// samples converted at a time
+#define METER_CHUNK 4096
+
+struct meter_level {
+	float peak;          // of the last block, 0.0 to 1.0 of full scale
+	float rms;           // of the last block, 0.0 to 1.0 of full scale
+	unsigned long clips; // samples at full scale since meter_init()
+};
+
+struct meter_snapshot {
+	unsigned long blocks; // blocks processed
+	unsigned long gated;  // blocks under the gate
+	int active;           // last block is above the gate
+	int channels;
+	struct meter_level level[METER_MAX_CHANNELS];
+};
+
+struct meter_acc {
+	int32_t max, min;
+	uint64_t sum;     // of squares of the 16 most significant bits
+	uint32_t clips;
+};
+
+struct meter {
+	pcm_format_t format;
+	int bytes;     // per sample
+	int swap;      // byte order is not the host one
+	uint32_t flip; // sign bit of unsigned formats
+	int shift;     // to align to the most significant bit
+	int32_t clip;  // full scale (positive)
+
+	float gate;    // threshold (RMS), 0 is no gate
+	long hold;     // frames
+	long since;    // frames since the gate was last above the threshold
+
+	struct meter_acc acc[METER_MAX_CHANNELS];
+	int32_t chunk[METER_CHUNK];
+
+	atomic_uint seq;
+	struct meter_snapshot snapshot;
+};
+
+// Return -1 if format or channels are not supported
+static inline int
+meter_init(struct meter *m, pcm_format_t format, int channels)
+{
+	int bits;
+
+	memset(m, 0, sizeof(*m));
+	m->format = format;
+	m->snapshot.channels = channels;
+	if (channels < 1 || channels > METER_MAX_CHANNELS)
+		return -1;
+
+	switch (format) {
+	case PCM_FORMAT_U8:     m->flip = 0x80;       // fall through
+	case PCM_FORMAT_S8:     bits = 8;  break;
+	case PCM_FORMAT_U16_LE:
+	case PCM_FORMAT_U16_BE: m->flip = 0x8000;     // fall through
+	case PCM_FORMAT_S16_LE:
+	case PCM_FORMAT_S16_BE: bits = 16; break;
+	case PCM_FORMAT_U32_LE:
+	case PCM_FORMAT_U32_BE: m->flip = 0x80000000; // fall through
+	case PCM_FORMAT_S32_LE:
+	case PCM_FORMAT_S32_BE: bits = 32; break;
+	default:
+		return -1;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	m->swap = format == PCM_FORMAT_S16_BE || format == PCM_FORMAT_U16_BE ||
+	          format == PCM_FORMAT_S32_BE || format == PCM_FORMAT_U32_BE;
+#else
+	m->swap = format == PCM_FORMAT_S16_LE || format == PCM_FORMAT_U16_LE ||
+	          format == PCM_FORMAT_S32_LE || format == PCM_FORMAT_U32_LE;
+#endif
+
+	m->bytes = bits / 8;
+	m->shift = 32 - bits;
+	m->clip = (int32_t) (0x7fffffffU >> m->shift << m->shift);
+	atomic_init(&m->seq, 0);
+
+	return 0;
+}
+
+// Gate blocks with RMS under `threshold_db` (dB of full scale, e.g. -50),
+// keeping `hold` frames after the last block above it.
+static inline void
+meter_set_gate(struct meter *m, double threshold_db, long hold)
+{
+	m->gate = pow(10, threshold_db / 20);
+	m->hold = hold;
+	m->since = hold; // closed
+}
+
+static inline void
+meter_convert(struct meter *m, const uint8_t *in, int32_t *out, int n)
+{
+	uint16_t v16;
+	uint32_t v32;
+	int i;
+
+	switch (m->bytes) {
+	case 1:
+		for (i = 0; i < n; i++)
+			out[i] = (int32_t) ((uint32_t) (in[i] ^ m->flip) << 24);
+		break;
+	case 2:
+		for (i = 0; i < n; i++) {
+			memcpy(&v16, in + 2 * i, 2);
+			if (m->swap)
+				v16 = __builtin_bswap16(v16);
+			out[i] = (int32_t) ((uint32_t) (v16 ^ m->flip) << 16);
+		}
+		break;
+	case 4:
+		for (i = 0; i < n; i++) {
+			memcpy(&v32, in + 4 * i, 4);
+			if (m->swap)
+				v32 = __builtin_bswap32(v32);
+			out[i] = (int32_t) (v32 ^ m->flip);
+		}
+		break;
+	}
+}
+
+// `stride` is the distance between samples of a channel. Inlined with a
+// constant stride, so that the loop is vectorized for it.
+static inline __attribute__((always_inline)) void
+meter_reduce(struct meter_acc *acc, const int32_t *x, int frames, int stride,
+             int32_t clip)
+{
+	int32_t max = acc->max, min = acc->min, v, s;
+	uint64_t sum = acc->sum;
+	uint32_t clips = acc->clips;
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		v = x[i * stride];
+		max = v > max ? v : max;
+		min = v < min ? v : min;
+		s = v >> 16;
+		sum += (uint32_t) (s * s);
+		clips += (v >= clip) | (v == INT32_MIN);
+	}
+
+	acc->max = max;
+	acc->min = min;
+	acc->sum = sum;
+	acc->clips = clips;
+}
+
+// Reduce interleaved samples of `channels` channels
+static inline void
+meter_reduce_interleaved(struct meter *m, const int32_t *x, int frames,
+                         int channels)
+{
+	int c;
+
+	switch (channels) {
+	case 1:
+		meter_reduce(&m->acc[0], x, frames, 1, m->clip);
+		break;
+	case 2:
+		for (c = 0; c < 2; c++)
+			meter_reduce(&m->acc[c], x + c, frames, 2, m->clip);
+		break;
+	case 4:
+		for (c = 0; c < 4; c++)
+			meter_reduce(&m->acc[c], x + c, frames, 4, m->clip);
+		break;
+	case 8:
+		for (c = 0; c < 8; c++)
+			meter_reduce(&m->acc[c], x + c, frames, 8, m->clip);
+		break;
+	default:
+		for (c = 0; c < channels; c++)
+			meter_reduce(&m->acc[c], x + c, frames, channels, m->clip);
+		break;
+	}
+}
+
+static inline void
+meter_begin(struct meter *m)
+{
+	int c;
+
+	for (c = 0; c < m->snapshot.channels; c++) {
+		m->acc[c].max = INT32_MIN;
+		m->acc[c].min = INT32_MAX;
+		m->acc[c].sum = 0;
+		m->acc[c].clips = 0;
+	}
+}
+
+// Publish levels of the block and return whether it is above the gate
+static inline int
+meter_end(struct meter *m, int frames)
+{
+	struct meter_snapshot *s = &m->snapshot;
+	struct meter_acc *acc;
+	float peak, rms;
+	int c, above = 0;
+	unsigned int seq;
+
+	seq = atomic_load_explicit(&m->seq, memory_order_relaxed);
+	atomic_store_explicit(&m->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	for (c = 0; c < s->channels; c++) {
+		acc = &m->acc[c];
+		peak = acc->max > -(int64_t) acc->min ? acc->max : -(int64_t) acc->min;
+		rms = frames ? sqrt((double) acc->sum / frames) / 32768 : 0;
+		s->level[c].peak = peak / 2147483648.0f;
+		s->level[c].rms = rms;
+		s->level[c].clips += acc->clips;
+		above |= rms > m->gate;
+	}
+
+	// a silent block is kept if it starts within hold
+	if (above)
+		m->since = 0;
+	s->active = !m->gate || above || m->since < m->hold;
+	if (!above && m->since < m->hold)
+		m->since += frames;
+	s->gated += !s->active;
+	s->blocks++;
+
+	atomic_store_explicit(&m->seq, seq + 2, memory_order_release);
+
+	return s->active;
+}
+
+// Measure a block of interleaved frames. Return 1 if it is above the
+// gate (or there is no gate), 0 if it is silent.
+static inline int
+meter_process(struct meter *m, const void *buf, int frames)
+{
+	int channels = m->snapshot.channels, per_chunk = METER_CHUNK / channels;
+	const uint8_t *p = buf;
+	int n;
+
+	meter_begin(m);
+	for (n = 0; n < frames; n += per_chunk) {
+		if (per_chunk > frames - n)
+			per_chunk = frames - n;
+		meter_convert(m, p + (long) n * channels * m->bytes, m->chunk,
+		              per_chunk * channels);
+		meter_reduce_interleaved(m, m->chunk, per_chunk, channels);
+	}
+
+	return meter_end(m, frames);
+}
+
+// Same as meter_process(), with a buffer for each channel
+static inline int
+meter_process_scattered(struct meter *m, void **bufs, int frames)
+{
+	const uint8_t *p;
+	int c, n, size;
+
+	meter_begin(m);
+	for (c = 0; c < m->snapshot.channels; c++) {
+		p = bufs[c];
+		for (n = 0; n < frames; n += METER_CHUNK) {
+			size = frames - n < METER_CHUNK ? frames - n : METER_CHUNK;
+			meter_convert(m, p + (long) n * m->bytes, m->chunk, size);
+			meter_reduce(&m->acc[c], m->chunk, size, 1, m->clip);
+		}
+	}
+
+	return meter_end(m, frames);
+}
+
+// Copy the levels of the last block. May be called from any thread.
+static inline void
+meter_read(struct meter *m, struct meter_snapshot *s)
+{
+	unsigned int seq;
+
+	do {
+		seq = atomic_load_explicit(&m->seq, memory_order_acquire);
+		memcpy(s, &m->snapshot, sizeof(*s));
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq & 1 ||
+	         seq != atomic_load_explicit(&m->seq, memory_order_relaxed));
+}
+
+// dB of full scale, -inf for silence
+static inline double
+meter_db(float level)
+{
+	return 20 * log10(level);
+}
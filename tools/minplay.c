@@ -12,6 +12,7 @@
 // E.g.: cat file.wav | ./minplay > /dev/pcmC0D0p
 // Playback is resumed after resuming from Stopped state.
 
+#include <errno.h>     // errno, EAGAIN, EPIPE
 #include <stdint.h>    // uint32_t
 #include <sys/ioctl.h> // ioctl()
 #include <unistd.h>    // read(), write()
@@ -40,16 +41,36 @@ main()
 	if (read(0, &c, sizeof(c)) != sizeof(c))
 		return 1;
 
-	struct sound_info i;
-	if (read(0, &i, sizeof(i)) != sizeof(i))
+	struct sound_info i; // only linear PCM (format 1) is played
+	if (c.size < sizeof(i) || read(0, &i, sizeof(i)) != sizeof(i))
+		return 1;
+
+	// Rest of the info chunk (chunks have even size). With
+	// WAVE_FORMAT_EXTENSIBLE (0xfffe), the format is in the subformat
+	// GUID, 8 bytes into it.
+	static const unsigned char pcm_guid[16] = { 0x01, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+	unsigned char ext[64];
+	int rest = c.size - sizeof(i) + c.size % 2, j;
+	if (rest > (int) sizeof(ext) || read(0, ext, rest) != rest)
+		return 1;
+	if (i.format == 0xfffe && rest >= 24) {
+		for (j = 0; j < 16 && ext[8 + j] == pcm_guid[j]; j++);
+		if (j == 16)
+			i.format = 1;
+	}
+	if (i.format != 1)
 		return 1;
 
 	struct chunk_header d; // data chunk header
 	if (read(0, &d, sizeof(d)) != sizeof(d))
 		return 1;
 
+	int frame = i.channels * i.bits_per_sample / 8;
+	if (frame == 0)
+		return 1;
+
 	struct snd_pcm_hw_params p;
-	int j;
 	for (j = 0; j < sizeof(p);       j++) *((char*) &p       + j) = 0x00;
 	for (j = 0; j < sizeof(p.masks); j++) *((char*) &p.masks + j) = 0xff;
 	for (j = 0; j < sizeof(p.intervals) / sizeof(struct snd_interval); j++)
@@ -70,10 +91,28 @@ main()
 	if (ioctl(1, SNDRV_PCM_IOCTL_HW_PARAMS, &p) == -1)
 		return 1;
 
+	// Reads and writes may be short. The device takes whole frames, so a
+	// partial one is kept for the next read. An underrun (or Stopped
+	// state) is recovered, other errors end playback.
 	char buffer[16384];
-	while (    read(0, buffer, sizeof(buffer)) > 0 &&
-	        ( write(1, buffer, sizeof(buffer)) > 0 ||
-	          ioctl(1, SNDRV_PCM_IOCTL_PREPARE) == 0 ) );
+	ssize_t n = 0, k, w;
+	while ((k = read(0, buffer + n, sizeof(buffer) - n)) > 0) {
+		n += k;
+		for (w = 0; n - w >= frame; w += k) {
+			k = write(1, buffer + w, (n - w) / frame * frame);
+			if (k == -1 && errno == EPIPE) {
+				if (ioctl(1, SNDRV_PCM_IOCTL_PREPARE) == -1)
+					return 1;
+				k = 0;
+			} else if (k == -1 && errno == EAGAIN) {
+				k = 0;
+			} else if (k <= 0) {
+				return 1;
+			}
+		}
+		for (j = 0; j < n - w; j++) buffer[j] = buffer[w + j];
+		n -= w;
+	}
 
 	return 0;
 }
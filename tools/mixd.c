@@ -0,0 +1,465 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Own a playback device and mix the sound of many processes into it
+// (only one process can set up a device).
+//
+// Clients attach through a Unix socket (see mixd.h): each gets a ring in
+// shared memory (a memfd passed with SCM_RIGHTS), written by the client
+// and read by the mixer without system calls or locks.
+//
+// The mixer thread keeps LEAD periods queued in the device. The device
+// does not interrupt at each period (PCM_INTERRUPT): the mixer sleeps
+// with pcm_timer_wait() until the hardware position leaves room for a
+// period, then takes up to a period from each ring, adds them with
+// saturation and writes the period. So the latency of a client is the
+// period it keeps queued plus the device's lead. The cost of a client is
+// its share of the addition and its ring: nothing else grows with the
+// number of clients.
+//
+// The main thread accepts clients and detaches them when their socket
+// is closed. A slot goes through FREE, ACTIVE (mixed), CLOSING (asked
+// to stop mixing) and CLOSED (mixer stopped), so that a ring is unmapped
+// only when the mixer no longer reads it.
+//
+// Without a device (or with -e), the device is emulated by the clock.
+//
+// E.g.: ./mixd -c 0 -D 0 -p 256 &
+//       ./mixtone -f 440 & ./mixtone -f 660
+
+#define _GNU_SOURCE // memfd_create()
+
+#include <errno.h>      // errno, EPIPE
+#include <poll.h>       // poll()
+#include <pthread.h>    // pthread_create()
+#include <sched.h>      // sched_setscheduler()
+#include <signal.h>     // signal()
+#include <stdatomic.h>  // atomic_*
+#include <stdint.h>     // int16_t, int32_t, uint64_t
+#include <stdio.h>      // printf(), perror()
+#include <stdlib.h>     // atoi(), calloc()
+#include <string.h>     // strncpy()
+#include <sys/mman.h>   // memfd_create(), mmap()
+#include <sys/socket.h> // socket(), bind(), accept4(), sendmsg()
+#include <sys/un.h>     // struct sockaddr_un
+#include <time.h>       // clock_gettime(), clock_nanosleep()
+#include <unistd.h>     // getopt(), ftruncate(), close(), unlink()
+
+#include "nanoalsa.h"
+#include "mixd.h"
+
+#define MAX_CLIENTS 64
+
+// periods queued in the device
+#define LEAD 2
+
+// device buffer (periods)
+#define PERIODS 4
+
+// interval for checking slots to free (ms)
+#define CONTROL_INTERVAL 100
+
+enum { FREE, ACTIVE, CLOSING, CLOSED };
+
+struct client {
+	atomic_int state;
+	int sock;
+	struct mixd_ring *ring;
+	size_t size;
+	long frames; // ring size (the client may change the one in `ring`)
+	int started; // client has written (mixer only)
+};
+
+static struct {
+	unsigned int rate;
+	int channels;
+	int period;
+	int emulate;
+	int fd;
+} cfg = { .rate = 48000, .channels = 2, .period = 256, .fd = -1 };
+
+static struct client clients[MAX_CLIENTS];
+
+static volatile sig_atomic_t        keep_running = 1;
+static void on_signal(int signum) { keep_running = 0; }
+
+static inline uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Mixer
+// ========================================================================
+
+// Add up to a period of a client's ring to `acc`
+static void
+mix_client(struct client *c, int32_t *acc, uint64_t now)
+{
+	struct mixd_ring *r = c->ring;
+	uint64_t read = atomic_load_explicit(&r->read, memory_order_relaxed);
+	uint64_t write = atomic_load_explicit(&r->write, memory_order_acquire);
+	uint64_t queued = write - read;
+	long frames = c->frames, offset = read % frames, n, first, i;
+	int16_t *p;
+
+	// the ring is written by the client: trust none of its sizes
+	if (queued > (uint64_t) frames)
+		queued = frames;
+	n = queued < (uint64_t) cfg.period ? (long) queued : cfg.period;
+	if (n)
+		c->started = 1;
+	else if (c->started)
+		atomic_fetch_add_explicit(&r->underruns, 1, memory_order_relaxed);
+	if (n && n < cfg.period)
+		atomic_fetch_add_explicit(&r->underruns, 1, memory_order_relaxed);
+
+	first = n < frames - offset ? n : frames - offset;
+	p = r->data + offset * cfg.channels;
+	for (i = 0; i < first * cfg.channels; i++)
+		acc[i] += p[i];
+	p = r->data - first * cfg.channels;
+	for (i = first * cfg.channels; i < n * cfg.channels; i++)
+		acc[i] += p[i];
+
+	atomic_store_explicit(&r->read, read + n, memory_order_release);
+	atomic_store_explicit(&r->mixed_at, now, memory_order_relaxed);
+}
+
+static void
+mix(int32_t *acc, int16_t *out)
+{
+	uint64_t now = now_ns();
+	int i, state, samples = cfg.period * cfg.channels;
+
+	for (i = 0; i < samples; i++)
+		acc[i] = 0;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		state = atomic_load_explicit(&clients[i].state,
+		                             memory_order_acquire);
+		if (state == ACTIVE)
+			mix_client(&clients[i], acc, now);
+		else if (state == CLOSING)
+			atomic_store_explicit(&clients[i].state, CLOSED,
+			                      memory_order_release);
+	}
+
+	for (i = 0; i < samples; i++)
+		out[i] = acc[i] > INT16_MAX ? INT16_MAX :
+		         acc[i] < INT16_MIN ? INT16_MIN : acc[i];
+}
+
+// Prepare, queue the lead as silence (which starts the device) and
+// return frames written
+static long
+device_start(int16_t *out)
+{
+	int i;
+
+	memset(out, 0, cfg.period * cfg.channels * sizeof(int16_t));
+	if (pcm_prepare(cfg.fd) == -1)
+		return -1;
+	for (i = 0; i < LEAD; i++) {
+		if (pcm_write(cfg.fd, out, cfg.period) != cfg.period)
+			return -1;
+	}
+
+	return (long) LEAD * cfg.period;
+}
+
+static void*
+mixer_thread(void *arg)
+{
+	int32_t *acc = calloc(cfg.period * cfg.channels, sizeof(int32_t));
+	int16_t *out = calloc(cfg.period * cfg.channels, sizeof(int16_t));
+	struct sched_param sp = {.sched_priority = 50};
+	pcm_timer_t timer = {.fd = -1};
+	pcm_sync_t sync;
+	struct timespec ts;
+	uint64_t start = now_ns(), at;
+	long written = -1;
+	int n;
+
+	// it is fine not to be permitted
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+
+	// the emulated device starts with the lead queued, as the device
+	if (acc && out && (cfg.emulate || pcm_timer_init(&timer, cfg.rate) == 0))
+		written = cfg.emulate ? LEAD * cfg.period : device_start(out);
+
+	while (keep_running && written != -1) {
+		if (cfg.emulate) {
+			// position reaches written - (LEAD - 1) periods at `at`
+			at = start + (written - (LEAD - 1) * cfg.period) *
+			     1000000000ULL / cfg.rate;
+			ts.tv_sec = at / 1000000000ULL;
+			ts.tv_nsec = at % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			mix(acc, out);
+			written += cfg.period;
+			continue;
+		}
+
+		if (pcm_timer_wait(cfg.fd, &timer,
+		                   written - (LEAD - 1) * cfg.period, &sync) == -1)
+			break;
+		if (sync.status.state == PCM_STATE_XRUN) {
+			fputs("Underrun\n", stderr);
+			written = device_start(out);
+			continue;
+		}
+
+		mix(acc, out);
+		n = pcm_write(cfg.fd, out, cfg.period);
+		if (n == -1 && errno == EPIPE) {
+			fputs("Underrun\n", stderr);
+			written = device_start(out);
+			continue;
+		}
+		if (n == -1)
+			break;
+		written += n;
+	}
+
+	if (keep_running)
+		perror("Mixer stopped");
+	keep_running = 0;
+	if (timer.fd != -1)
+		pcm_timer_close(&timer);
+	free(acc);
+	free(out);
+
+	return NULL;
+}
+
+static int
+device_open(int card, int device)
+{
+	pcm_params_t params;
+
+	cfg.fd = pcm_open(card, device, PCM_OUTPUT);
+	if (cfg.fd == -1)
+		return -1;
+
+	pcm_params_init(&params);
+	pcm_set(&params, PCM_ACCESS,      PCM_ACCESS_RW);
+	pcm_set(&params, PCM_FORMAT,      PCM_FORMAT_S16_LE);
+	pcm_set(&params, PCM_CHANNELS,    cfg.channels);
+	pcm_set(&params, PCM_RATE,        cfg.rate);
+	pcm_set(&params, PCM_PERIOD_SIZE, cfg.period);
+	pcm_set(&params, PCM_PERIODS,     PERIODS);
+	pcm_set(&params, PCM_INTERRUPT,   1);
+	pcm_set(&params, PCM_TSTAMP_TYPE, PCM_CLOCK_MONOTONIC);
+	pcm_set(&params, PCM_START_THRESHOLD, LEAD * cfg.period);
+	if (pcm_params_setup(cfg.fd, &params) == -1) {
+		close(cfg.fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Clients
+// ========================================================================
+
+// Create the ring of slot `c` and send it through its socket
+static int
+client_attach(struct client *c, int sock)
+{
+	struct mixd_info info = {
+		.magic = MIXD_MAGIC, .rate = cfg.rate, .channels = cfg.channels,
+		.period = cfg.period, .frames = cfg.period * MIXD_RING_PERIODS,
+	};
+	char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct iovec iov = {&info, sizeof(info)};
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control, .msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	int fd, ret;
+
+	info.size = sizeof(struct mixd_ring) +
+	            (uint64_t) info.frames * info.channels * sizeof(int16_t);
+
+	fd = memfd_create("mixd", MFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (ftruncate(fd, info.size) == -1) {
+		close(fd);
+		return -1;
+	}
+	c->ring = mmap(NULL, info.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               fd, 0);
+	if (c->ring == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	c->ring->info = info;
+	c->size = info.size;
+	c->frames = info.frames;
+	c->sock = sock;
+	c->started = 0;
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+	ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	close(fd);
+	if (ret != sizeof(info)) {
+		munmap(c->ring, c->size);
+		return -1;
+	}
+
+	atomic_store_explicit(&c->state, ACTIVE, memory_order_release);
+	return 0;
+}
+
+static void
+client_free(struct client *c, int index)
+{
+	printf("client %d detached (%lu underruns)\n", index,
+	       (unsigned long) atomic_load(&c->ring->underruns));
+	munmap(c->ring, c->size);
+	close(c->sock);
+	atomic_store(&c->state, FREE);
+}
+
+static void
+accept_client(int listen_fd)
+{
+	int sock, i;
+
+	sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (sock == -1)
+		return;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (atomic_load(&clients[i].state) == FREE)
+			break;
+	}
+	if (i == MAX_CLIENTS || client_attach(&clients[i], sock) == -1) {
+		fputs("Client refused\n", stderr);
+		close(sock);
+		return;
+	}
+
+	printf("client %d attached\n", i);
+}
+
+static int
+listen_on(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int fd;
+
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+	    listen(fd, 16) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static const char *usage =
+"usage: mixd [-s socket] [-c card] [-D device] [-r rate] [-C channels]\n"
+"            [-p period] [-e]\n"
+"Default: socket " MIXD_SOCKET " (or MIXD_SOCKET), card 0, device 0,\n"
+"         rate 48000, 2 channels, period 256\n"
+"-e emulates the device (also used if the device can not be opened)\n";
+
+int
+main(int argc, char **argv)
+{
+	const char *path = mixd_socket_path();
+	struct pollfd fds[1 + MAX_CLIENTS];
+	int slots[1 + MAX_CLIENTS];
+	int card = 0, device = 0, listen_fd, opt, i, n;
+	pthread_t mixer;
+
+	while ((opt = getopt(argc, argv, "s:c:D:r:C:p:e")) != -1) {
+		switch (opt) {
+		case 's': path = optarg; break;
+		case 'c': card = atoi(optarg); break;
+		case 'D': device = atoi(optarg); break;
+		case 'r': cfg.rate = atoi(optarg); break;
+		case 'C': cfg.channels = atoi(optarg); break;
+		case 'p': cfg.period = atoi(optarg); break;
+		case 'e': cfg.emulate = 1; break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (!cfg.rate || cfg.channels < 1 || cfg.period < 1) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	if (!cfg.emulate && device_open(card, device) == -1) {
+		perror("Using emulated device");
+		cfg.emulate = 1;
+	}
+
+	listen_fd = listen_on(path);
+	if (listen_fd == -1) {
+		perror(path);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (pthread_create(&mixer, NULL, mixer_thread, NULL)) {
+		perror("Error while starting mixer");
+		return 1;
+	}
+
+	while (keep_running) {
+		fds[0] = (struct pollfd) {.fd = listen_fd, .events = POLLIN};
+		for (i = 0, n = 1; i < MAX_CLIENTS; i++) {
+			switch (atomic_load(&clients[i].state)) {
+			case ACTIVE:
+				// a client only closes its socket
+				fds[n] = (struct pollfd) {.fd = clients[i].sock};
+				slots[n++] = i;
+				break;
+			case CLOSED:
+				client_free(&clients[i], i);
+				break;
+			}
+		}
+
+		if (poll(fds, n, CONTROL_INTERVAL) <= 0)
+			continue;
+
+		if (fds[0].revents & POLLIN)
+			accept_client(listen_fd);
+		for (i = 1; i < n; i++) {
+			if (fds[i].revents)
+				atomic_store(&clients[slots[i]].state, CLOSING);
+		}
+	}
+
+	pthread_join(mixer, NULL);
+	close(listen_fd);
+	unlink(path);
+	if (!cfg.emulate)
+		close(cfg.fd);
+
+	return 0;
+}
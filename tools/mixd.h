@@ -0,0 +1,217 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Client side of mixd (see mixd.c), the daemon that owns a playback
+// device and mixes the sound of many processes into it.
+//
+// A client connects to the daemon's Unix socket and receives a memory
+// file descriptor (memfd) with a ring of its own, with signed 16-bit
+// interleaved frames at the rate and channels of the device. The ring
+// has one writer (the client) and one reader (the daemon), which only
+// publish their positions with atomic stores, so no system call is made
+// to pass sound.
+//
+// At each period, the daemon takes up to a period from each ring. To be
+// mixed with about one period of latency, a client keeps a period
+// queued: it waits with mixd_wait() until the ring is empty (i.e. the
+// daemon took it) and writes the next one. mixd_wait() sleeps until the
+// daemon's next mix, predicted from the time of its last one, so it
+// wakes up once per period.
+//
+// The client is detached when it closes the socket (or exits).
+
+#include <errno.h>      // errno, EINTR, EPROTO
+#include <stdatomic.h>  // atomic_*
+#include <stdint.h>     // int16_t, uint32_t, uint64_t
+#include <stdlib.h>     // getenv()
+#include <string.h>     // memcpy(), strncpy()
+#include <sys/mman.h>   // mmap(), munmap()
+#include <sys/socket.h> // socket(), connect(), recvmsg()
+#include <sys/un.h>     // struct sockaddr_un
+#include <time.h>       // clock_gettime(), clock_nanosleep()
+#include <unistd.h>     // close()
+
+#define MIXD_MAGIC 0x6d697864 // "mixd"
+
+// socket, unless set by MIXD_SOCKET in environment
+#define MIXD_SOCKET "/tmp/mixd.socket"
+
+// ring size (periods)
+#define MIXD_RING_PERIODS 4
+
+// wakeup after the daemon's mix
+#define MIXD_WAIT_SLACK_NS 50000
+
+// Sent with the memfd on connection
+struct mixd_info {
+	uint32_t magic;
+	uint32_t rate;
+	uint32_t channels;
+	uint32_t period; // frames mixed at a time
+	uint32_t frames; // ring size
+	uint64_t size;   // of the memfd (bytes)
+};
+
+// At the start of the memfd. Positions are frames since connection, and
+// are each on its own cache line so that the writer and the reader do
+// not share one.
+struct mixd_ring {
+	struct mixd_info info;
+
+	_Alignas(64) atomic_uint_least64_t write; // client
+
+	_Alignas(64) atomic_uint_least64_t read;  // daemon
+	atomic_uint_least64_t mixed_at;   // CLOCK_MONOTONIC of last mix (ns)
+	atomic_uint_least64_t underruns;  // mixes with less than a period
+
+	_Alignas(64) int16_t data[];
+};
+
+struct mixd_client {
+	int sock;
+	struct mixd_ring *ring;
+	struct mixd_info info;
+};
+
+static inline const char*
+mixd_socket_path(void)
+{
+	const char *path = getenv("MIXD_SOCKET");
+	return path ? path : MIXD_SOCKET;
+}
+
+// Receive the ring from the daemon and map it
+static inline int
+mixd_receive(struct mixd_client *c)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {&c->info, sizeof(c->info)};
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control, .msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int fd;
+
+	if (recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(c->info))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = EPROTO;
+		return -1;
+	}
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	if (c->info.magic != MIXD_MAGIC) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+
+	c->ring = mmap(NULL, c->info.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               fd, 0);
+	close(fd);
+
+	return c->ring == MAP_FAILED ? -1 : 0;
+}
+
+// Connect to the daemon at `path` (NULL for the default) and map the
+// ring it gives.
+static inline int
+mixd_connect(struct mixd_client *c, const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+	strncpy(addr.sun_path, path ? path : mixd_socket_path(),
+	        sizeof(addr.sun_path) - 1);
+
+	c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (c->sock == -1)
+		return -1;
+
+	if (connect(c->sock, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+	    mixd_receive(c) == -1) {
+		close(c->sock);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void
+mixd_close(struct mixd_client *c)
+{
+	munmap(c->ring, c->info.size);
+	close(c->sock);
+}
+
+// Frames written and not yet mixed
+static inline long
+mixd_queued(struct mixd_client *c)
+{
+	return atomic_load_explicit(&c->ring->write, memory_order_relaxed) -
+	       atomic_load_explicit(&c->ring->read, memory_order_acquire);
+}
+
+// Copy up to `frames` frames to the ring. Return frames copied (fewer
+// if the ring is full).
+static inline int
+mixd_write(struct mixd_client *c, const int16_t *buf, int frames)
+{
+	struct mixd_ring *r = c->ring;
+	uint64_t write = atomic_load_explicit(&r->write, memory_order_relaxed);
+	long room = c->info.frames - mixd_queued(c), offset, first;
+	int channels = c->info.channels;
+
+	if (frames > room)
+		frames = room;
+
+	offset = write % c->info.frames;
+	first = frames < c->info.frames - offset ? frames : c->info.frames - offset;
+	memcpy(r->data + offset * channels, buf,
+	       first * channels * sizeof(int16_t));
+	memcpy(r->data, buf + first * channels,
+	       (frames - first) * channels * sizeof(int16_t));
+
+	atomic_store_explicit(&r->write, write + frames, memory_order_release);
+
+	return frames;
+}
+
+// Sleep until at most `frames` frames are queued
+static inline int
+mixd_wait(struct mixd_client *c, long frames)
+{
+	uint64_t period_ns = c->info.period * 1000000000ULL / c->info.rate;
+	uint64_t next, now;
+	struct timespec ts;
+	int err;
+
+	while (mixd_queued(c) > frames) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+		// the daemon's next mix
+		next = atomic_load_explicit(&c->ring->mixed_at,
+		                            memory_order_relaxed) + period_ns;
+		if (next < now)
+			next = now + period_ns / 4;
+		next += MIXD_WAIT_SLACK_NS;
+
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		// absolute, so a sleep interrupted by a signal is just repeated
+		while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+		                              &ts, NULL)) == EINTR)
+			;
+		if (err) {
+			errno = err;
+			return -1;
+		}
+	}
+
+	return 0;
+}
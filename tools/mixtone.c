@@ -0,0 +1,74 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Play a tone through mixd (see mixd.h), keeping one period queued.
+//
+// E.g.: ./mixtone -f 440 -t 5
+
+#include <math.h>   // sin()
+#include <stdint.h> // int16_t
+#include <stdio.h>  // printf(), perror()
+#include <stdlib.h> // atof(), calloc()
+#include <time.h>   // clock_gettime()
+#include <unistd.h> // getopt()
+
+#include "mixd.h"
+
+int
+main(int argc, char **argv)
+{
+	const char *path = NULL;
+	double frequency = 440, seconds = 5, phase = 0, step;
+	struct mixd_client c;
+	struct timespec start, now;
+	int16_t *buffer;
+	unsigned int i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:f:t:")) != -1) {
+		switch (opt) {
+		case 's': path = optarg; break;
+		case 'f': frequency = atof(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		default:
+			fputs("usage: mixtone [-s socket] [-f frequency] "
+			      "[-t seconds]\n", stderr);
+			return 1;
+		}
+	}
+
+	if (mixd_connect(&c, path) == -1) {
+		perror("Error while connecting to mixd");
+		return 1;
+	}
+
+	buffer = calloc(c.info.period * c.info.channels, sizeof(int16_t));
+	if (!buffer)
+		return 1;
+	step = 2 * M_PI * frequency / c.info.rate;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (i = 0; i < c.info.period; i++, phase += step) {
+			for (j = 0; j < c.info.channels; j++)
+				buffer[i * c.info.channels + j] = 4000 * sin(phase);
+		}
+
+		// a period is queued: wait until it is taken
+		if (mixd_write(&c, buffer, c.info.period) != (int) c.info.period ||
+		    mixd_wait(&c, 0) == -1)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (now.tv_sec - start.tv_sec +
+	         (now.tv_nsec - start.tv_nsec) / 1e9 < seconds);
+
+	printf("%lu underruns\n", (unsigned long) atomic_load(&c.ring->underruns));
+	mixd_close(&c);
+	free(buffer);
+
+	return 0;
+}
@@ -0,0 +1,389 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Find the smallest period and buffer sizes that keep the probability of
+// an underrun below a target, and save them (see tune.h).
+//
+// Run it under the load the application will have (-l adds threads that
+// keep CPUs busy). For each period size, a trial plays silence for a few
+// seconds with a large buffer. At each wakeup, the hardware position is
+// taken from pcm_sync(): frames available beyond the period are how late
+// the wakeup was. An underrun happens when a wakeup is later than the
+// buffer has room for beyond one period (the margin).
+//
+// Lateness is measured in time, and its tail is modeled as exponential
+// (fitted to the 5% latest wakeups), so probabilities far smaller than
+// one per trial are estimated. The buffer needed for a period is the
+// period plus the lateness exceeded with the target probability, rounded
+// up to whole periods.
+//
+// Periods are tried from the smallest, and the search stops when the
+// period alone is larger than the best buffer found. The best pair is
+// then verified with a trial of its own, and grown by a period while it
+// underruns.
+//
+// Without a device (or with -e), wakeups are emulated by sleeping until
+// the position a device would reach, so the lateness is that of the
+// scheduler.
+//
+// E.g.: ./pcmtune /dev/snd/pcmC0D0p
+//       ./pcmtune -e -l 4 -p 1e-5
+
+#include <fcntl.h>    // open()
+#include <math.h>     // log()
+#include <poll.h>     // poll()
+#include <pthread.h>  // pthread_create()
+#include <stdio.h>    // printf(), perror()
+#include <stdlib.h>   // calloc(), free(), qsort()
+#include <sys/stat.h> // open()
+#include <time.h>     // clock_gettime(), clock_nanosleep()
+#include <unistd.h>   // getopt(), close(), sysconf()
+
+#include "nanoalsa.h"
+#include "tune.h"
+
+#define CHANNELS 2
+#define MIN_PERIOD 16
+#define MAX_PERIOD 8192
+
+// periods in buffer while measuring (room for late wakeups)
+#define TRIAL_PERIODS 8
+
+// periods in buffer the verification may grow to
+#define MAX_PERIODS 64
+
+// fraction of samples in the modeled tail
+#define TAIL 0.05
+
+static volatile int loading = 1;
+
+static void*
+load_thread(void *arg)
+{
+	volatile unsigned long n = 0;
+
+	while (loading)
+		n++;
+
+	return NULL;
+}
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct trial {
+	unsigned int period, buffer;
+	double *late;  // lateness of each wakeup (seconds)
+	int n, max_n;
+	int xruns;
+	long min_fill; // frames in buffer at the latest wakeup (margin)
+};
+
+// Set up the device and fill its buffer, which starts it
+static int
+trial_open(char *device, unsigned int rate, struct trial *t, char *silence)
+{
+	pcm_params_t params;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd == -1)
+		return -1;
+
+	pcm_params_init(&params);
+	pcm_set(&params, PCM_ACCESS,      PCM_ACCESS_RW);
+	pcm_set(&params, PCM_FORMAT,      PCM_FORMAT_S16_LE);
+	pcm_set(&params, PCM_CHANNELS,    CHANNELS);
+	pcm_set(&params, PCM_RATE,        rate);
+	pcm_set(&params, PCM_PERIOD_SIZE, t->period);
+	pcm_set(&params, PCM_BUFFER_SIZE, t->buffer);
+	pcm_set(&params, PCM_START_THRESHOLD, t->buffer);
+	if (pcm_params_setup(fd, &params) == -1 ||
+	    pcm_write(fd, silence, t->buffer) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Play silence for `seconds`. Return -1 if the device does not accept
+// the sizes.
+static int
+trial_run(char *device, int emulate, unsigned int rate, double seconds,
+          struct trial *t)
+{
+	pcm_sync_t sync;
+	struct pollfd pfd;
+	struct timespec ts;
+	long fill, appl = 0;
+	double start, end, target, hw;
+	char *silence;
+	int fd = -1;
+
+	t->n = t->xruns = 0;
+	t->min_fill = t->buffer;
+	t->max_n = seconds * rate / t->period + 1;
+	t->late = calloc(t->max_n, sizeof(double));
+	silence = calloc(t->buffer, CHANNELS * 2);
+	if (!t->late || !silence)
+		return -1;
+
+	if (!emulate) {
+		fd = trial_open(device, rate, t, silence);
+		if (fd == -1) {
+			free(silence);
+			return -1;
+		}
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+	}
+
+	appl = t->buffer;
+	start = now();
+	end = start + seconds;
+
+	while (t->n < t->max_n && now() < end) {
+		if (emulate) {
+			// position reaches appl - buffer + period (one period
+			// of room) at `target`
+			target = start + (double) (appl - t->buffer + t->period) / rate;
+			ts.tv_sec = target;
+			ts.tv_nsec = (target - ts.tv_sec) * 1e9;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			hw = (now() - start) * rate;
+			fill = appl - (long) hw;
+		} else {
+			if (poll(&pfd, 1, -1) == -1 ||
+			    pcm_sync(fd, &sync, PCM_REQUEST_HW) == -1)
+				break;
+			if (sync.status.state == PCM_STATE_XRUN) {
+				t->xruns++;
+				if (pcm_prepare(fd) == -1 ||
+				    pcm_write(fd, silence, t->buffer) < 0)
+					break;
+				continue;
+			}
+			fill = sync.control.appl_ptr - sync.status.hw_ptr;
+		}
+
+		if (fill < t->min_fill)
+			t->min_fill = fill;
+		if (fill < 0) {
+			// emulated underrun: restart from here
+			t->xruns++;
+			start = now();
+			appl = t->buffer;
+			continue;
+		}
+
+		// frames available beyond one period
+		t->late[t->n++] = (double) (t->buffer - t->period - fill) / rate;
+
+		if (!emulate && pcm_write(fd, silence, t->period) < 0)
+			break;
+		appl += t->period;
+	}
+
+	if (!emulate) {
+		pcm_stop(fd);
+		close(fd);
+	}
+	free(silence);
+
+	return 0;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Lateness exceeded with probability `p`. Below the tail, it is the
+// quantile of the samples. In the tail, the excesses over its threshold
+// are taken as exponential, whose mean is the mean excess. It is never
+// below the latest wakeup seen, as tails are often heavier.
+static double
+trial_lateness(struct trial *t, double p)
+{
+	double threshold, excess = 0, late;
+	int i, first;
+
+	qsort(t->late, t->n, sizeof(double), compare_double);
+
+	first = t->n - (int) (t->n * TAIL);
+	if (first >= t->n)
+		return t->late[t->n - 1];
+	threshold = t->late[first];
+
+	if (p >= TAIL)
+		return t->late[(int) ((1 - p) * (t->n - 1))];
+
+	for (i = first; i < t->n; i++)
+		excess += t->late[i] - threshold;
+	excess /= t->n - first;
+
+	late = threshold + excess * log(TAIL / p);
+	return late > t->late[t->n - 1] ? late : t->late[t->n - 1];
+}
+
+// Buffer size for `period` under lateness `late` (seconds)
+static unsigned int
+buffer_for(unsigned int period, unsigned int rate, double late)
+{
+	unsigned int periods;
+
+	if (late < 0)
+		late = 0;
+	periods = 1 + (unsigned int) ceil(late * rate / period);
+
+	return (periods < 2 ? 2 : periods) * period;
+}
+
+static double
+quantile(struct trial *t, double q)
+{
+	return t->late[(int) (q * (t->n - 1))];
+}
+
+static const char *usage =
+"usage: pcmtune [-e] [-n] [-r rate] [-p probability] [-t seconds]\n"
+"               [-l load_threads] [device]\n"
+"Default: /dev/snd/pcmC0D0p, rate 48000, probability 1e-6 (of an\n"
+"underrun per period), 2 seconds per trial\n"
+"-e emulates the device (also used if the device can not be opened)\n"
+"-n does not save the result\n";
+
+int
+main(int argc, char **argv)
+{
+	char *device = "/dev/snd/pcmC0D0p";
+	unsigned int rate = 48000, period, best_period = 0, best_buffer = 0;
+	unsigned int buffer;
+	double probability = 1e-6, seconds = 2, late;
+	int emulate = 0, save = 1, load = 0, opt, i;
+	pthread_t threads[64];
+	struct trial t;
+
+	while ((opt = getopt(argc, argv, "enr:p:t:l:")) != -1) {
+		switch (opt) {
+		case 'e': emulate = 1; break;
+		case 'n': save = 0; break;
+		case 'r': rate = atoi(optarg); break;
+		case 'p': probability = atof(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'l': load = atoi(optarg); break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		device = argv[optind];
+	if (probability <= 0 || probability >= 1 || seconds <= 0) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	if (!emulate) {
+		i = open(device, O_RDWR);
+		if (i == -1) {
+			perror("Using emulated device");
+			emulate = 1;
+		} else {
+			close(i);
+		}
+	}
+
+	if (load > 64)
+		load = 64;
+	for (i = 0; i < load; i++)
+		pthread_create(&threads[i], NULL, load_thread, NULL);
+
+	printf("period buffer | wakeups | late (us) p50 / p99 / max "
+	       "| xruns | needed buffer\n");
+	for (period = MIN_PERIOD; period <= MAX_PERIOD; period *= 2) {
+		// no buffer with this period beats the best one
+		if (best_buffer && period >= best_buffer)
+			break;
+
+		t.period = period;
+		t.buffer = period * TRIAL_PERIODS;
+		// sizes not accepted by the device
+		if (trial_run(device, emulate, rate, seconds, &t) == -1) {
+			free(t.late);
+			continue;
+		}
+		if (t.n < 2) {
+			free(t.late);
+			continue;
+		}
+
+		late = trial_lateness(&t, probability);
+		buffer = buffer_for(period, rate, late);
+		printf("%6u %6u | %7d | %8.0f / %5.0f / %6.0f | %5d | %u\n",
+		       period, t.buffer, t.n, quantile(&t, 0.5) * 1e6,
+		       quantile(&t, 0.99) * 1e6, t.late[t.n - 1] * 1e6,
+		       t.xruns, buffer);
+
+		// underruns even with a large buffer: period is too small
+		if (!t.xruns && (!best_buffer || buffer < best_buffer)) {
+			best_period = period;
+			best_buffer = buffer;
+		}
+		free(t.late);
+	}
+
+	if (!best_buffer) {
+		fputs("No period size works\n", stderr);
+		loading = 0;
+		return 1;
+	}
+
+	// verify, growing the buffer while it underruns
+	for (;;) {
+		t.period = best_period;
+		t.buffer = best_buffer;
+		if (trial_run(device, emulate, rate, seconds, &t) == -1) {
+			perror("Error while verifying");
+			loading = 0;
+			return 1;
+		}
+		printf("verify %u %u: %d xruns, min margin %ld frames\n",
+		       best_period, best_buffer, t.xruns, t.min_fill);
+		free(t.late);
+		if (!t.xruns)
+			break;
+		best_buffer += best_period;
+		if (best_buffer > best_period * MAX_PERIODS) {
+			fputs("No buffer size works\n", stderr);
+			loading = 0;
+			return 1;
+		}
+	}
+
+	loading = 0;
+	for (i = 0; i < load; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("%s: period %u buffer %u (%.2f ms)\n", device, best_period,
+	       best_buffer, best_buffer * 1000.0 / rate);
+
+	if (save && !emulate && tune_save(device, rate, best_period,
+	                                  best_buffer) == -1) {
+		perror("Error while saving");
+		return 1;
+	}
+
+	return 0;
+}
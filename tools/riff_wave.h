@@ -4,17 +4,76 @@
 
 // 2020-06-04
 
+#include <stdint.h> // uint8_t, uint16_t, uint32_t
+#include <string.h> // memcmp()
+#include <unistd.h> // read()
+
 #define RIFF_TYPE_WAVE 0x45564157
 
 #define CHUNK_INFO  0x20746d66
 #define CHUNK_DATA  0x61746164
 
+// sound_info.format
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_ADPCM      0x0002 // Microsoft ADPCM
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_ALAW       0x0006
+#define WAVE_FORMAT_MULAW      0x0007
+#define WAVE_FORMAT_IMA_ADPCM  0x0011
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe // actual format in the extension
+
 // info chunk
 struct sound_info {
 	uint16_t format;
 	uint16_t channels;
 	uint32_t rate;
 	uint32_t bytes_per_second;
-	uint16_t bytes_per_sample;
+	uint16_t bytes_per_sample; // bytes per frame (block for ADPCM)
 	uint16_t bits_per_sample;
 };
+
+// After sound_info with WAVE_FORMAT_EXTENSIBLE
+struct sound_info_extensible {
+	uint16_t size;          // of the rest of the extension (22)
+	uint16_t valid_bits;    // per sample
+	uint32_t channel_mask;  // speaker positions
+	uint32_t sub_format;    // subformat GUID: WAVE_FORMAT_* and
+	uint8_t guid_tail[12];  // wave_guid_tail for the standard ones
+};
+
+static const uint8_t wave_guid_tail[12] = {
+	0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+};
+
+// Read the rest of the information chunk of `size` bytes, after
+// sound_info. With WAVE_FORMAT_EXTENSIBLE, `info->format` is set to the
+// subformat if it is a standard one (e.g. WAVE_FORMAT_PCM). Return -1 on
+// error.
+static int
+wave_read_extension(int fd, struct sound_info *info, uint32_t size)
+{
+	struct sound_info_extensible ext;
+	uint32_t left = size - sizeof(*info) + size % 2; // chunks are even
+	char skip[64];
+	ssize_t n;
+
+	if (size < sizeof(*info))
+		return -1;
+
+	if (info->format == WAVE_FORMAT_EXTENSIBLE) {
+		if (left < sizeof(ext) || read(fd, &ext, sizeof(ext)) != sizeof(ext))
+			return -1;
+		left -= sizeof(ext);
+		if (ext.sub_format <= 0xffff &&
+		    !memcmp(ext.guid_tail, wave_guid_tail, sizeof(wave_guid_tail)))
+			info->format = ext.sub_format;
+	}
+
+	for (; left; left -= n) {
+		n = read(fd, skip, left < sizeof(skip) ? left : sizeof(skip));
+		if (n <= 0)
+			return -1;
+	}
+
+	return 0;
+}
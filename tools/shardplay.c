@@ -0,0 +1,164 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Play a tone on many PCM devices (or substreams) at once, with the
+// streams shared among one worker thread per CPU (see engine.h).
+//
+// -w  number of workers (default: number of CPUs)
+// -c  extra processing per period (iterations), to emulate DSP cost.
+//     Streams listed later get a higher cost, so that load is unequal.
+//
+// Every second, the load of each worker is printed.
+//
+// E.g.: ./shardplay -c 20000 /dev/snd/pcmC0D0p /dev/snd/pcmC1D0p ...
+
+#define _GNU_SOURCE // pthread_setaffinity_np()
+
+#include <errno.h>    // errno
+#include <fcntl.h>    // open()
+#include <math.h>     // sin(), fmod()
+#include <signal.h>   // signal()
+#include <stdint.h>   // int16_t
+#include <stdio.h>    // perror(), printf()
+#include <stdlib.h>   // atoi(), calloc()
+#include <string.h>   // strerror()
+#include <sys/stat.h> // open()
+#include <unistd.h>   // getopt(), sleep(), close()
+
+#include "nanoalsa.h"
+#include "engine.h"
+
+#define RATE        48000
+#define CHANNELS    2
+#define PERIOD_SIZE 480
+
+static volatile sig_atomic_t        keep_running = 1;
+static void on_sigint(int signum) { keep_running = 0; }
+
+struct tone {
+	struct engine_stream stream;
+	double phase, step;
+	long cost; // extra iterations per period
+	int16_t buffer[PERIOD_SIZE * CHANNELS];
+};
+
+static int
+tone_process(struct engine_stream *stream)
+{
+	struct tone *t = (struct tone*) stream;
+	volatile double dsp = 0;
+	long i;
+	int j, written;
+
+	for (i = 0; i < t->cost; i++)
+		dsp += i * 0.5;
+
+	for (j = 0; j < PERIOD_SIZE; j++) {
+		t->buffer[j * CHANNELS] = t->buffer[j * CHANNELS + 1] =
+			8000 * sin(t->phase + j * t->step);
+	}
+
+	// Device is nonblocking: on a short write the rest is dropped and
+	// rendered again next time, so the tone continues from the last
+	// frame written.
+	written = pcm_write(stream->fd, t->buffer, PERIOD_SIZE);
+	if (written == -1 && errno != EAGAIN && pcm_prepare(stream->fd) == -1)
+		return -1; // see tone_drop()
+	if (written > 0)
+		t->phase = fmod(t->phase + written * t->step, 2 * M_PI);
+
+	return 0;
+}
+
+// Not served by the engine (it is full), or removed from it on error
+static void
+tone_drop(struct engine_stream *stream, int error)
+{
+	fprintf(stderr, "Stream dropped: %s\n", strerror(error));
+	close(stream->fd);
+}
+
+static int
+tone_open(struct tone *t, char *device, int index, long cost)
+{
+	pcm_params_t params;
+
+	t->stream.fd = open(device, O_RDWR | O_NONBLOCK);
+	if (t->stream.fd == -1) {
+		perror(device);
+		return -1;
+	}
+
+	pcm_params_init(&params);
+	pcm_set(&params, PCM_ACCESS,      PCM_ACCESS_RW);
+	pcm_set(&params, PCM_FORMAT,      PCM_FORMAT_S16_LE);
+	pcm_set(&params, PCM_RATE,        RATE);
+	pcm_set(&params, PCM_CHANNELS,    CHANNELS);
+	pcm_set(&params, PCM_PERIOD_SIZE, PERIOD_SIZE);
+	pcm_set(&params, PCM_PERIODS,     4);
+	if (pcm_params_setup(t->stream.fd, &params) == -1) {
+		perror(device);
+		close(t->stream.fd);
+		return -1;
+	}
+
+	t->stream.events = EPOLLOUT;
+	t->stream.process = tone_process;
+	t->stream.drop = tone_drop;
+	t->stream.period_ns = PERIOD_SIZE * 1000000000L / RATE;
+	t->phase = 0;
+	t->step = 2 * M_PI * (220 + 20 * index) / RATE;
+	t->cost = cost * (index + 1);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct engine engine;
+	struct tone *tones;
+	int opt, i, n_workers = 0;
+	long cost = 0;
+
+	signal(SIGINT, on_sigint);
+
+	while ((opt = getopt(argc, argv, "w:c:")) != -1) {
+		switch (opt) {
+		case 'w': n_workers = atoi(optarg); break;
+		case 'c': cost = atol(optarg); break;
+		default:
+			fputs("usage: shardplay [-w workers] [-c cost] "
+			      "<pcm_device_file>...\n", stderr);
+			return 1;
+		}
+	}
+
+	tones = calloc(argc - optind, sizeof(*tones));
+	if (!tones || engine_start(&engine, n_workers) == -1) {
+		perror("Error while starting engine");
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (tone_open(&tones[i - optind], argv[i], i - optind, cost) == 0)
+			engine_add(&engine, &tones[i - optind].stream);
+	}
+
+	while (keep_running) {
+		sleep(1);
+		for (i = 0; i < engine.n_workers; i++) {
+			printf("%5.1f%% (%d) ", atomic_load(&engine.workers[i].load)
+			       * 100.0 / ENGINE_LOAD_FULL, engine.workers[i].n_streams);
+		}
+		putchar('\n');
+	}
+
+	engine_stop(&engine);
+	free(tones);
+
+	return 0;
+}
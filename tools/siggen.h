@@ -0,0 +1,438 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Generate test signals of known content, and check captured sound
+// against them frame by frame.
+//
+// Each sample is a function of the frame index, the channel and a seed
+// only, so any frame can be rendered again without state: the capture
+// side of a loopback renders what it expects and compares bytes. Signals:
+//
+// - sine:    a tone (frequency from the seed), each channel in its own
+//            phase
+// - sweep:   a linear chirp from 20 Hz to 0.45 of the rate, one per second
+// - noise:   white noise from a counter-based hash (no repetition)
+// - impulse: full scale once every 1/10 s, channel c at frame c of it
+//
+// Samples are first rendered as signed 32-bit, aligned to the most
+// significant bit, one channel at a time in a contiguous block. Then
+// they are converted to the pcm_format_t and interleaved. loadgen.o is
+// built with -O3 (see tools/Makefile), at which GCC 12 vectorizes the
+// noise loop and the conversions to 8- and 16-bit formats (check with
+// -fopt-info-vec); the other loops stay scalar.
+//
+// Checking (siggen_check_*()) first locks on the signal: it skips frames
+// until SIGGEN_SYNC of them match the start of the signal (e.g. silence
+// before the loopback delivers). Then each frame must match the next
+// expected one. On a mismatch, the expected index is searched within
+// SIGGEN_WINDOW frames ahead (frames were dropped) and behind (frames
+// were duplicated) for SIGGEN_SYNC matching frames; if none match, the
+// frame is counted as corrupt. Counts are exact with noise. Other
+// signals repeat (e.g. a sine drop of a whole number of cycles, or of
+// frames between impulses, looks like nothing happened), so they detect
+// errors but may miscount them.
+
+#include <math.h>   // floor(), fabsf()
+#include <stdint.h> // int32_t, uint32_t, uint64_t
+#include <stdlib.h> // malloc(), free()
+#include <string.h> // memcmp(), memcpy(), memmove(), strcmp()
+
+#include "nanoalsa.h"
+
+// frames rendered at a time
+#define SIGGEN_CHUNK 1024
+
+// frames that must match to lock and to resynchronize
+#define SIGGEN_SYNC 16
+
+// frames searched ahead and behind on a mismatch
+#define SIGGEN_WINDOW 256
+
+enum siggen_type {
+	SIGGEN_SINE,
+	SIGGEN_SWEEP,
+	SIGGEN_NOISE,
+	SIGGEN_IMPULSE,
+};
+
+static const char *siggen_names[] = { "sine", "sweep", "noise", "impulse" };
+
+struct siggen {
+	enum siggen_type type;
+	int channels;
+	int bytes;       // per sample
+	int frame_bytes;
+	int swap;        // byte order is not the host one
+	uint32_t flip;   // sign bit of unsigned formats
+
+	uint32_t seed;
+	uint32_t step;   // sine: phase per frame (2^32 is a cycle)
+	uint64_t length; // sweep: frames per sweep; impulse: between impulses
+	double a, b;     // sweep: cycles = a * m + b * m * m
+
+	int32_t chunk[SIGGEN_CHUNK];
+};
+
+// Return the type named `name`, or -1
+static int
+siggen_type(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (!strcmp(name, siggen_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+// Hash of 32 bits, with good avalanche (lowbias32)
+static inline uint32_t
+siggen_hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// Return -1 if format or channels are not supported
+static int
+siggen_init(struct siggen *g, enum siggen_type type, pcm_format_t format,
+            int channels, unsigned int rate, uint32_t seed)
+{
+	memset(g, 0, sizeof(*g));
+	if (channels < 1 || !rate)
+		return -1;
+
+	switch (format) {
+	case PCM_FORMAT_U8:     g->flip = 0x80;       // fall through
+	case PCM_FORMAT_S8:     g->bytes = 1; break;
+	case PCM_FORMAT_U16_LE:
+	case PCM_FORMAT_U16_BE: g->flip = 0x8000;     // fall through
+	case PCM_FORMAT_S16_LE:
+	case PCM_FORMAT_S16_BE: g->bytes = 2; break;
+	case PCM_FORMAT_U32_LE:
+	case PCM_FORMAT_U32_BE: g->flip = 0x80000000; // fall through
+	case PCM_FORMAT_S32_LE:
+	case PCM_FORMAT_S32_BE: g->bytes = 4; break;
+	default:
+		return -1;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	g->swap = format == PCM_FORMAT_S16_BE || format == PCM_FORMAT_U16_BE ||
+	          format == PCM_FORMAT_S32_BE || format == PCM_FORMAT_U32_BE;
+#else
+	g->swap = format == PCM_FORMAT_S16_LE || format == PCM_FORMAT_U16_LE ||
+	          format == PCM_FORMAT_S32_LE || format == PCM_FORMAT_U32_LE;
+#endif
+
+	g->type = type;
+	g->channels = channels;
+	g->frame_bytes = g->bytes * channels;
+	g->seed = siggen_hash(seed);
+
+	// sine from 100 Hz to about 2 kHz
+	g->step = (100 + g->seed % 1900) * (4294967296.0 / rate);
+
+	switch (type) {
+	case SIGGEN_SWEEP:
+		g->length = rate;
+		g->a = 20.0 / rate;
+		g->b = (0.45 - 20.0 / rate) / (2.0 * rate);
+		break;
+	case SIGGEN_IMPULSE:
+		g->length = rate / 10 > (unsigned int) channels ? rate / 10 :
+		            (unsigned int) channels;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+// sin(pi * x) for x in [-1, 1), within 0.1% (a parabola, refined)
+static inline float
+siggen_sin(float x)
+{
+	float y = 4 * x * (1 - fabsf(x));
+	return 0.225f * (y * fabsf(y) - y) + y;
+}
+
+// half of full scale
+#define SIGGEN_AMPLITUDE 1073741824.0f
+
+static void
+siggen_sine(struct siggen *g, int32_t *out, uint64_t index, int n, int c)
+{
+	uint32_t phase = (uint32_t) index * g->step + siggen_hash(g->seed + c);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float x = (int32_t) (phase + (uint32_t) i * g->step) / 2147483648.0f;
+		out[i] = siggen_sin(x) * SIGGEN_AMPLITUDE;
+	}
+}
+
+static void
+siggen_sweep(struct siggen *g, int32_t *out, uint64_t index, int n, int c)
+{
+	double offset = (double) siggen_hash(g->seed + c) / 4294967296.0;
+	uint64_t m0 = index % g->length;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		double m = m0 + i >= g->length ? m0 + i - g->length : m0 + i;
+		double cycles = g->a * m + g->b * m * m + offset;
+		float x = 2 * (cycles - floor(cycles)) - 1;
+		out[i] = siggen_sin(x) * SIGGEN_AMPLITUDE;
+	}
+}
+
+static void
+siggen_noise(struct siggen *g, int32_t *out, uint64_t index, int n, int c)
+{
+	uint32_t key = siggen_hash(g->seed ^ siggen_hash(index >> 32) ^
+	                           (uint32_t) c * 0x9e3779b9);
+	uint32_t base = index;
+	int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = (int32_t) siggen_hash((base + i) ^ key) >> 1;
+}
+
+static void
+siggen_impulse(struct siggen *g, int32_t *out, uint64_t index, int n, int c)
+{
+	uint64_t m0 = index % g->length;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t m = m0 + i >= g->length ? m0 + i - g->length : m0 + i;
+		out[i] = m == (uint64_t) c ? 0x7fffffff : 0;
+	}
+}
+
+// Convert to the format, `stride` bytes apart
+static void
+siggen_store(struct siggen *g, const int32_t *in, uint8_t *out, int n,
+             int stride)
+{
+	uint16_t v16;
+	uint32_t v32;
+	int i;
+
+	switch (g->bytes) {
+	case 1:
+		for (i = 0; i < n; i++)
+			out[i * stride] = (uint32_t) in[i] >> 24 ^ g->flip;
+		break;
+	case 2:
+		for (i = 0; i < n; i++) {
+			v16 = (uint32_t) in[i] >> 16 ^ g->flip;
+			if (g->swap)
+				v16 = __builtin_bswap16(v16);
+			memcpy(out + i * stride, &v16, 2);
+		}
+		break;
+	case 4:
+		for (i = 0; i < n; i++) {
+			v32 = (uint32_t) in[i] ^ g->flip;
+			if (g->swap)
+				v32 = __builtin_bswap32(v32);
+			memcpy(out + i * stride, &v32, 4);
+		}
+		break;
+	}
+}
+
+// Render `frames` interleaved frames, from frame `index` of the signal
+static void
+siggen_render(struct siggen *g, void *out, uint64_t index, int frames)
+{
+	uint8_t *p = out;
+	int n, c;
+
+	while (frames > 0) {
+		n = frames < SIGGEN_CHUNK ? frames : SIGGEN_CHUNK;
+		// noise takes the high 32 bits of the index once per chunk
+		if (g->type == SIGGEN_NOISE && (uint32_t) index + n < (uint32_t) index)
+			n = -(uint32_t) index;
+
+		for (c = 0; c < g->channels; c++) {
+			switch (g->type) {
+			case SIGGEN_SINE:    siggen_sine(g, g->chunk, index, n, c); break;
+			case SIGGEN_SWEEP:   siggen_sweep(g, g->chunk, index, n, c); break;
+			case SIGGEN_NOISE:   siggen_noise(g, g->chunk, index, n, c); break;
+			case SIGGEN_IMPULSE: siggen_impulse(g, g->chunk, index, n, c); break;
+			}
+			siggen_store(g, g->chunk, p + c * g->bytes, n, g->frame_bytes);
+		}
+
+		p += (long) n * g->frame_bytes;
+		index += n;
+		frames -= n;
+	}
+}
+
+// Render `frames` frames of silence (not zero bytes in unsigned formats)
+static void
+siggen_silence(struct siggen *g, void *out, int frames)
+{
+	int n;
+
+	memset(g->chunk, 0, sizeof(g->chunk));
+	for (n = 0; n < frames * g->channels; n += SIGGEN_CHUNK) {
+		siggen_store(g, g->chunk, (uint8_t*) out + (long) n * g->bytes,
+		             frames * g->channels - n < SIGGEN_CHUNK ?
+		             frames * g->channels - n : SIGGEN_CHUNK, g->bytes);
+	}
+}
+
+// Check
+// ========================================================================
+
+struct siggen_check {
+	struct siggen *g;
+	int locked;
+	uint64_t expect; // index of the next frame
+
+	uint8_t *buf;    // frames captured and not yet checked
+	int fill, size;  // frames
+	uint8_t *ref;    // frames rendered to compare with
+
+	unsigned long verified;   // frames that matched
+	unsigned long skipped;    // frames before locking
+	unsigned long dropped;
+	unsigned long duplicated;
+	unsigned long corrupt;
+};
+
+// `frames` is the most frames passed to siggen_check_push() at a time
+static int
+siggen_check_init(struct siggen_check *c, struct siggen *g, int frames)
+{
+	memset(c, 0, sizeof(*c));
+	c->g = g;
+	c->size = frames + SIGGEN_SYNC;
+	c->buf = malloc((long) c->size * g->frame_bytes);
+	c->ref = malloc((long) SIGGEN_CHUNK * g->frame_bytes);
+	if (!c->buf || !c->ref) {
+		free(c->buf);
+		free(c->ref);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+siggen_check_destroy(struct siggen_check *c)
+{
+	free(c->buf);
+	free(c->ref);
+}
+
+// Lock again from the start of the signal (e.g. after the stream was
+// restarted). Counts are kept.
+static void
+siggen_check_reset(struct siggen_check *c)
+{
+	c->locked = 0;
+	c->expect = 0;
+	c->fill = 0;
+}
+
+// Whether SIGGEN_SYNC frames at `p` match the signal from `index`
+static int
+siggen_check_match(struct siggen_check *c, const uint8_t *p, uint64_t index)
+{
+	siggen_render(c->g, c->ref, index, SIGGEN_SYNC);
+	return !memcmp(p, c->ref, SIGGEN_SYNC * c->g->frame_bytes);
+}
+
+// Find where the signal continues at `p`. Return 0 if found.
+static int
+siggen_check_resync(struct siggen_check *c, const uint8_t *p)
+{
+	uint64_t d;
+
+	for (d = 1; d <= SIGGEN_WINDOW; d++) {
+		if (siggen_check_match(c, p, c->expect + d)) {
+			c->dropped += d;
+			c->expect += d;
+			return 0;
+		}
+		if (d <= c->expect && siggen_check_match(c, p, c->expect - d)) {
+			c->duplicated += d;
+			c->expect -= d;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+// Check captured frames
+static void
+siggen_check_push(struct siggen_check *c, const void *in, int frames)
+{
+	int fb = c->g->frame_bytes, pos = 0, n, k;
+	uint8_t *p;
+
+	memcpy(c->buf + (long) c->fill * fb, in, (long) frames * fb);
+	c->fill += frames;
+
+	while (pos < c->fill) {
+		p = c->buf + (long) pos * fb;
+
+		if (!c->locked) {
+			if (c->fill - pos < SIGGEN_SYNC)
+				break;
+			if (siggen_check_match(c, p, 0)) {
+				c->locked = 1;
+				c->expect = 0;
+			} else {
+				c->skipped++;
+				pos++;
+			}
+			continue;
+		}
+
+		// compare a chunk, then find the first mismatch in it
+		n = c->fill - pos < SIGGEN_CHUNK ? c->fill - pos : SIGGEN_CHUNK;
+		siggen_render(c->g, c->ref, c->expect, n);
+		k = n;
+		if (memcmp(p, c->ref, (long) n * fb)) {
+			for (k = 0; k < n; k++) {
+				if (memcmp(p + k * fb, c->ref + k * fb, fb))
+					break;
+			}
+		}
+		pos += k;
+		c->expect += k;
+		c->verified += k;
+		if (k == n)
+			continue;
+
+		// mismatch: wait for enough frames to resynchronize
+		if (c->fill - pos < SIGGEN_SYNC)
+			break;
+		if (siggen_check_resync(c, c->buf + (long) pos * fb) == -1) {
+			c->corrupt++;
+			c->expect++;
+			pos++;
+		}
+	}
+
+	c->fill -= pos;
+	memmove(c->buf, c->buf + (long) pos * fb, (long) c->fill * fb);
+}
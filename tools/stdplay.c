@@ -7,13 +7,74 @@
 // Read RIFF/wave files from stdin and write PCM data to stdout.
 // If stdout is a sound device it's set up.
 //
+// 2026-10-18
+//
+// Data from stdin goes through a jitter buffer (see jitter.h), so that a
+// producer that is bursty or slightly slower or faster than the device
+// (e.g. a decoder or a network stream) does not make it underrun.
+//
 // E.g.: cat file.wav | ./stdplay > /dev/pcmC0D0p
 
+#include <errno.h>  // errno, EAGAIN, EPIPE
+#include <fcntl.h>  // fcntl()
+#include <poll.h>   // poll()
+#include <stdio.h>  // fprintf()
+#include <stdlib.h> // malloc(), free()
 #include <unistd.h> // read(), write()
 
-#include "pcm.h"
+#include "nanoalsa.h"
 #include "riff.h"
 #include "riff_wave.h"
+#include "jitter.h"
+
+// device period (milliseconds) and periods in the device buffer
+#define PERIOD_MS 10
+#define PERIODS   4
+
+// ring of the jitter buffer, besides what fills the device (seconds)
+#define RING_SECONDS 2
+
+// Copy stdin to stdout (not a sound device). Writes may be short.
+static int
+copy(void)
+{
+	char buffer[8192];
+	ssize_t n, w, k;
+
+	while ((n = read(0, buffer, sizeof(buffer))) > 0) {
+		for (w = 0; w < n; w += k) {
+			k = write(1, buffer + w, n - w);
+			if (k == -1)
+				return 1;
+		}
+	}
+
+	return n == -1;
+}
+
+// Write `frames` frames to the device, preparing it after an underrun.
+// The device starts again only when its buffer is full (see the start
+// threshold in main()). Return 1 if it underran, 0 if not, -1 on error.
+static int
+play(char *buffer, int frames, int frame_bytes)
+{
+	int xrun = 0;
+	long n;
+
+	while (frames > 0) {
+		n = pcm_write(1, buffer, frames);
+		if (n == -1 && errno == EPIPE && pcm_prepare(1) == 0) {
+			xrun = 1;
+			continue;
+		}
+		if (n == -1)
+			return -1;
+		buffer += n * frame_bytes;
+		frames -= n;
+	}
+
+	return xrun;
+}
 
 int
 main()
@@ -26,21 +87,87 @@ main()
 	struct sound_info   i;
 	if (read(0, &c, sizeof(c)) != sizeof(c) || c.id != CHUNK_INFO ||
 	    read(0, &i, sizeof(i)) != sizeof(i) ||
+	    wave_read_extension(0, &i, c.size) == -1 ||
+	    i.format != WAVE_FORMAT_PCM ||
 	    read(0, &c, sizeof(c)) != sizeof(c) || c.id != CHUNK_DATA)
 		return 1;
 
-	struct pcm_hw_params p;
-	pcm_hw_params_init(&p);
+	pcm_params_t p;
+	pcm_params_init(&p);
 	pcm_set(&p, PCM_ACCESS,      PCM_ACCESS_RW);
 	pcm_set(&p, PCM_SAMPLE_BITS, i.bits_per_sample);
 	pcm_set(&p, PCM_RATE,        i.rate);
 	pcm_set(&p, PCM_CHANNELS,    i.channels);
+	// Low latency: the jitter buffer, not the device, absorbs the producer
+	unsigned long period = i.rate * PERIOD_MS / 1000;
+	if (!period)
+		period = 1;
+	pcm_set(&p, PCM_PERIOD_SIZE, period);
+	pcm_set(&p, PCM_BUFFER_SIZE, period * PERIODS);
+	pcm_set(&p, PCM_START_THRESHOLD, period * PERIODS);
 	// Do not fail on setup because user may be writing to a regular file.
-	pcm_hw_params_setup(1, &p);
+	if (pcm_params_setup(1, &p) == -1)
+		return copy();
 
-	char buffer[8192];
-	while ( read(0, buffer, sizeof(buffer)) > 0 &&
-	       write(1, buffer, sizeof(buffer)) > 0);
+	period = pcm_get(&p, PCM_PERIOD_SIZE, 0);
+	unsigned long buffer_size = pcm_get(&p, PCM_BUFFER_SIZE, 0);
+	int frame_bytes = i.channels * i.bits_per_sample / 8;
+	char *buffer = malloc(period * frame_bytes);
+	struct jitter j;
+	if (!buffer || jitter_init(&j, i.rate, i.channels, i.bits_per_sample / 8,
+	                           buffer_size + i.rate * RING_SECONDS,
+	                           period) == -1)
+		return 1;
+
+	fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+
+	// Start (and start again after an underrun) when the device buffer can
+	// be filled leaving the target level in the ring, or when the ring is
+	// full. Stop when stdin ends and the ring is empty. stdin is not polled
+	// while the ring is full, nor after its end.
+	struct pollfd fds[2] = { { .events = POLLIN }, { .fd = 1, .events = POLLOUT } };
+	long ring = j.size / j.frame_bytes, start, n;
+	unsigned long xruns = 0;
+	int eof = 0, started = 0, frames, ret;
+	while (!eof || jitter_level(&j)) {
+		start = j.target + buffer_size;
+		if (start > ring)
+			start = ring;
+		if (!started && (eof || jitter_level(&j) >= start))
+			started = 1;
+
+		fds[0].fd = !eof && !jitter_full(&j) ? 0 : -1;
+		if (poll(fds, started ? 2 : 1, -1) == -1)
+			return 1;
+
+		if (fds[0].revents) {
+			n = jitter_fill(&j, 0);
+			if (n == 0)
+				eof = 1;
+			else if (n == -1 && errno != EAGAIN)
+				return 1;
+		}
+
+		if (started && fds[1].revents) {
+			frames = jitter_get(&j, buffer, period, !eof);
+			ret = play(buffer, frames, frame_bytes);
+			if (ret == -1)
+				return 1;
+			if (ret == 1) {
+				started = 0;
+				xruns++;
+			}
+		}
+	}
+
+	pcm_drain(1);
+	if (xruns)
+		fprintf(stderr, "%lu underruns\n", xruns);
+	if (j.concealed)
+		fprintf(stderr, "%lu frames of silence inserted\n", j.concealed);
+
+	jitter_destroy(&j);
+	free(buffer);
 
 	return 0;
 }
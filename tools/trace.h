@@ -0,0 +1,145 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Record NanoALSA trace events (see "Tracing" in nanoalsa.h) in a ring
+// buffer and save them to a binary file. Convert the file to Chrome trace
+// JSON (chrome://tracing, ui.perfetto.dev) with trace2json.
+//
+// Both nanoalsa and the application must be compiled with
+// -DNANOALSA_TRACE.
+//
+// Recording an event takes a vDSO clock_gettime() and an atomic
+// increment, so it may be left enabled. When the ring is full, the oldest
+// events are overwritten.
+//
+// E.g.:
+//     trace_start(1 << 16);
+//     ... playback ...
+//     trace_save("playback.trace");
+
+#include <errno.h>       // errno, EINVAL
+#include <fcntl.h>       // open()
+#include <stdatomic.h>   // atomic_*
+#include <stdint.h>      // uint*_t
+#include <stdlib.h>      // calloc()
+#include <sys/stat.h>    // open()
+#include <sys/syscall.h> // SYS_gettid
+#include <time.h>        // clock_gettime()
+#include <unistd.h>      // write(), close(), syscall()
+
+#include "nanoalsa.h"
+
+#define TRACE_MAGIC 0x5254414e // "NATR"
+
+struct trace_file_header {
+	uint32_t magic;
+	uint32_t count; // number of records that follow
+};
+
+struct trace_record {
+	uint64_t time; // CLOCK_MONOTONIC (ns)
+	uint32_t tid;
+	int32_t  event; // pcm_trace_event_t
+	int32_t  fd;
+	int32_t  pad;
+	int64_t  a, b;
+};
+
+// The recorder needs NANOALSA_TRACE. The file format above does not
+// (e.g. for trace2json).
+#ifdef NANOALSA_TRACE
+
+static struct trace_record *trace_ring;
+static unsigned long trace_size; // power of two
+static atomic_ulong trace_count;
+
+static __thread uint32_t trace_tid;
+
+static void
+trace_hook(int event, int fd, long a, long b)
+{
+	unsigned long i = atomic_fetch_add_explicit(&trace_count, 1,
+	                                            memory_order_relaxed);
+	struct trace_record *r = &trace_ring[i & (trace_size - 1)];
+	struct timespec ts;
+
+	if (!trace_tid)
+		trace_tid = syscall(SYS_gettid);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	r->time  = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	r->tid   = trace_tid;
+	r->event = event;
+	r->fd    = fd;
+	r->a     = a;
+	r->b     = b;
+}
+
+// `size` (records, at least 1) is rounded down to a power of two
+static int
+trace_start(unsigned long size)
+{
+	if (!size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (size & (size - 1))
+		size &= size - 1;
+
+	trace_ring = calloc(size, sizeof(*trace_ring));
+	if (!trace_ring)
+		return -1;
+
+	trace_size = size;
+	atomic_store(&trace_count, 0);
+	pcm_trace_hook = trace_hook;
+
+	return 0;
+}
+
+static void
+trace_stop(void)
+{
+	pcm_trace_hook = NULL;
+}
+
+// Save recorded events, oldest first. Events recorded while saving may
+// be saved partially written.
+static int
+trace_save(const char *path)
+{
+	struct trace_file_header header = {.magic = TRACE_MAGIC};
+	unsigned long count = atomic_load(&trace_count), first = 0, n;
+	int fd, ret = 0;
+
+	if (count > trace_size)
+		first = count - trace_size;
+	header.count = count - first;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header))
+		ret = -1;
+
+	// the ring may wrap around: write in two parts
+	while (!ret && first < count) {
+		n = trace_size - (first & (trace_size - 1));
+		if (n > count - first)
+			n = count - first;
+		if (write(fd, &trace_ring[first & (trace_size - 1)],
+		          n * sizeof(*trace_ring)) != n * sizeof(*trace_ring))
+			ret = -1;
+		first += n;
+	}
+
+	close(fd);
+	return ret;
+}
+
+#endif // NANOALSA_TRACE
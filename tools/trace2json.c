@@ -0,0 +1,143 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Convert a trace file saved by trace_save() (see trace.h) to Chrome
+// trace JSON, which can be opened in chrome://tracing or
+// ui.perfetto.dev.
+//
+// - Blocking calls (write, read, actions, setup, timer sleep) are
+//   duration events in the thread that called them.
+// - appl_ptr - hw_ptr from pcm_sync() is a counter per file descriptor
+//   (frames queued for playback, or negative frames available for
+//   capture).
+// - State changes are instant events.
+//
+// E.g.: ./trace2json playback.trace > playback.json
+
+#include <stdio.h> // fopen(), fread(), printf()
+
+#include "nanoalsa.h"
+#include "trace.h"
+
+#define MAX_FD 1024
+
+static const char*
+action_name(long request)
+{
+	switch (request) {
+	case PCM_ACTION_PREPARE: return "prepare";
+	case PCM_ACTION_START:   return "start";
+	case PCM_ACTION_STOP:    return "stop";
+	case PCM_ACTION_DRAIN:   return "drain";
+	case PCM_ACTION_XRUN:    return "xrun";
+	case PCM_ACTION_RESET:   return "reset";
+	case PCM_ACTION_RESUME:  return "resume";
+	case PCM_ACTION_PAUSE:   return "pause";
+	case PCM_DO_REWIND:      return "rewind";
+	case PCM_DO_FORWARD:     return "forward";
+	default:                 return "ioctl";
+	}
+}
+
+static const char *state_names[] = {
+	[PCM_STATE_OPEN]         = "OPEN",
+	[PCM_STATE_SETUP]        = "SETUP",
+	[PCM_STATE_PREPARED]     = "PREPARED",
+	[PCM_STATE_RUNNING]      = "RUNNING",
+	[PCM_STATE_XRUN]         = "XRUN",
+	[PCM_STATE_DRAINING]     = "DRAINING",
+	[PCM_STATE_PAUSED]       = "PAUSED",
+	[PCM_STATE_SUSPENDED]    = "SUSPENDED",
+	[PCM_STATE_DISCONNECTED] = "DISCONNECTED",
+};
+
+static void
+print_event(struct trace_record *r, double us, const char *separator)
+{
+	printf("%s\n{\"pid\":1,\"tid\":%u,\"ts\":%.3f,", separator, r->tid, us);
+
+	switch (r->event) {
+	case PCM_TRACE_END:
+		printf("\"ph\":\"E\",\"args\":{\"ret\":%lld}}", (long long) r->a);
+		break;
+	case PCM_TRACE_WRITE:
+	case PCM_TRACE_READ:
+		printf("\"ph\":\"B\",\"name\":\"%s\",\"args\":{\"fd\":%d,"
+		       "\"frames\":%lld}}",
+		       r->event == PCM_TRACE_WRITE ? "write" : "read",
+		       r->fd, (long long) r->a);
+		break;
+	case PCM_TRACE_ACTION:
+		printf("\"ph\":\"B\",\"name\":\"%s\",\"args\":{\"fd\":%d,"
+		       "\"arg\":%lld}}",
+		       action_name(r->a), r->fd, (long long) r->b);
+		break;
+	case PCM_TRACE_SETUP:
+		printf("\"ph\":\"B\",\"name\":\"setup\",\"args\":{\"fd\":%d}}",
+		       r->fd);
+		break;
+	case PCM_TRACE_SLEEP:
+		printf("\"ph\":\"B\",\"name\":\"sleep\",\"args\":{\"fd\":%d,"
+		       "\"hw_pos\":%lld}}", r->fd, (long long) r->a);
+		break;
+	case PCM_TRACE_SYNC:
+		printf("\"ph\":\"C\",\"name\":\"fd %d queued\",\"args\":"
+		       "{\"frames\":%lld}}", r->fd, (long long) (r->b - r->a));
+		break;
+	case PCM_TRACE_STATE:
+		printf("\"ph\":\"i\",\"s\":\"p\",\"name\":\"fd %d %s\"}", r->fd,
+		       r->a >= 0 && r->a <= PCM_STATE_DISCONNECTED ?
+		       state_names[r->a] : "?");
+		break;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct trace_file_header header;
+	struct trace_record r;
+	int last_state[MAX_FD];
+	const char *separator = "";
+	uint64_t start = 0;
+	uint32_t i;
+	FILE *f;
+
+	if (argc < 2) {
+		fputs("usage: trace2json <trace_file>\n", stderr);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f || fread(&header, sizeof(header), 1, f) != 1 ||
+	    header.magic != TRACE_MAGIC) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	for (i = 0; i < MAX_FD; i++)
+		last_state[i] = -1;
+
+	printf("{\"traceEvents\":[");
+	for (i = 0; i < header.count && fread(&r, sizeof(r), 1, f) == 1; i++) {
+		if (!start)
+			start = r.time;
+
+		// only state changes are shown
+		if (r.event == PCM_TRACE_STATE && r.fd >= 0 && r.fd < MAX_FD) {
+			if (last_state[r.fd] == r.a)
+				continue;
+			last_state[r.fd] = r.a;
+		}
+
+		print_event(&r, (r.time - start) / 1000.0, separator);
+		separator = ",";
+	}
+	printf("\n]}\n");
+
+	fclose(f);
+	return 0;
+}
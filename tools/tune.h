@@ -0,0 +1,129 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Period and buffer sizes found by pcmtune (see pcmtune.c), saved per
+// device.
+//
+// The file is $NANOALSA_TUNE, or $HOME/.config/nanoalsa.tune. Each line
+// is:
+//
+//   <device path> <rate> <period size> <buffer size>
+//
+// Sizes are in frames at <rate>. For another rate, the period is scaled
+// and the buffer keeps the same number of periods.
+
+#include <stdio.h>  // fopen(), fgets(), fprintf()
+#include <stdlib.h> // getenv()
+#include <string.h> // strcmp()
+
+#include "nanoalsa.h"
+
+#define TUNE_LINE_MAX 512
+
+static inline const char*
+tune_path(char *path, int size)
+{
+	char *env = getenv("NANOALSA_TUNE");
+
+	if (env)
+		snprintf(path, size, "%s", env);
+	else if ((env = getenv("HOME")))
+		snprintf(path, size, "%s/.config/nanoalsa.tune", env);
+	else
+		return NULL;
+
+	return path;
+}
+
+// Return 0 and the sizes saved for `device`, or -1 if there are none.
+static inline int
+tune_load(const char *device, unsigned int *rate, unsigned int *period,
+          unsigned int *buffer)
+{
+	char path[TUNE_LINE_MAX], line[TUNE_LINE_MAX], name[TUNE_LINE_MAX];
+	int found = -1;
+	FILE *f;
+
+	if (!tune_path(path, sizeof(path)) || !(f = fopen(path, "r")))
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%511s %u %u %u", name, rate, period, buffer) == 4 &&
+		    !strcmp(name, device)) {
+			found = 0;
+			break;
+		}
+	}
+
+	fclose(f);
+	return found;
+}
+
+// Save sizes for `device`, replacing the previous ones
+static inline int
+tune_save(const char *device, unsigned int rate, unsigned int period,
+          unsigned int buffer)
+{
+	char path[TUNE_LINE_MAX], tmp[TUNE_LINE_MAX + 4];
+	char line[TUNE_LINE_MAX], name[TUNE_LINE_MAX];
+	FILE *in, *out;
+
+	if (!tune_path(path, sizeof(path)))
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+	out = fopen(tmp, "w");
+	if (!out)
+		return -1;
+
+	// keep lines of other devices
+	if ((in = fopen(path, "r"))) {
+		while (fgets(line, sizeof(line), in)) {
+			if (sscanf(line, "%511s", name) == 1 && strcmp(name, device))
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	fprintf(out, "%s %u %u %u\n", device, rate, period, buffer);
+
+	if (fclose(out) == EOF)
+		return -1;
+
+	// replace atomically
+	return rename(tmp, path);
+}
+
+// Set period and buffer sizes saved for `device` in `params` (rate must be
+// already set). `fd` is used for checking that the device accepts them.
+// Return -1 if there are no saved sizes or they do not fit; `params` is
+// then unchanged.
+static inline int
+tune_apply(int fd, const char *device, pcm_params_t *params)
+{
+	unsigned int tuned_rate, period, buffer, rate, periods;
+	pcm_params_t try = *params;
+
+	if (tune_load(device, &tuned_rate, &period, &buffer) == -1 || !period)
+		return -1;
+
+	// scale period to the rate (rounding up, so that time is not
+	// shorter), keeping the number of periods in buffer
+	rate = pcm_get_min(params, PCM_RATE);
+	if (rate != tuned_rate && tuned_rate) {
+		periods = (buffer + period - 1) / period;
+		period = ((unsigned long) period * rate + tuned_rate - 1) / tuned_rate;
+		buffer = periods * period;
+	}
+
+	pcm_set(&try, PCM_PERIOD_SIZE, period);
+	pcm_set(&try, PCM_BUFFER_SIZE, buffer);
+	if (pcm_params_refine(fd, &try) == -1)
+		return -1;
+
+	pcm_set(params, PCM_PERIOD_SIZE, period);
+	pcm_set(params, PCM_BUFFER_SIZE, buffer);
+	return 0;
+}
@@ -0,0 +1,297 @@
+// Copyright (C) 2026  Ricardo Biehl Pasquali
+//
+// License: See LICENSE file at the root of this repository.
+
+// 2026-10-18
+//
+// Decode wave (.wav) formats other than linear PCM to signed 16-bit
+// samples in host byte order (WAVE_DECODE_FORMAT), which sound devices
+// take without conversion.
+//
+// Supported formats (sound_info.format):
+//
+// - WAVE_FORMAT_MULAW, WAVE_FORMAT_ALAW (G.711): one byte per sample,
+//   decoded by a lookup table.
+// - WAVE_FORMAT_IMA_ADPCM, WAVE_FORMAT_ADPCM (Microsoft): 4 bits per
+//   sample in blocks of block_align bytes (sound_info.bytes_per_sample).
+//   Each block has a header with the decoder state, so blocks are
+//   decoded independently.
+// - WAVE_FORMAT_IEEE_FLOAT: 32-bit floats in [-1.0, 1.0], saturated.
+//
+// Data is decoded in units: one block for ADPCM, one frame otherwise.
+// G.711 is a table lookup per sample and ADPCM is sequential by nature.
+// The float loop has no dependencies between iterations; waveplay.o is
+// built with -O3 (see tools/Makefile), at which GCC 12 vectorizes it
+// (check with -fopt-info-vec).
+
+// Include riff_wave.h before this file.
+
+#include <stdint.h> // int16_t, uint8_t, uint32_t
+#include <string.h> // memcpy()
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WAVE_DECODE_FORMAT PCM_FORMAT_S16_BE
+#else
+#define WAVE_DECODE_FORMAT PCM_FORMAT_S16_LE
+#endif
+
+struct wave_decoder {
+	uint16_t format;
+	int channels;
+	int in_bytes;   // input bytes per unit
+	int out_frames; // output frames per unit
+	int16_t table[256]; // G.711
+};
+
+static int16_t
+mulaw_to_s16(uint8_t u)
+{
+	int t;
+
+	u = ~u;
+	t = ((u & 0x0f) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+
+	return u & 0x80 ? 0x84 - t : t - 0x84;
+}
+
+static int16_t
+alaw_to_s16(uint8_t a)
+{
+	int t, segment;
+
+	a ^= 0x55;
+	t = (a & 0x0f) << 4;
+	segment = (a & 0x70) >> 4;
+	if (segment == 0)
+		t += 8;
+	else
+		t = (t + 0x108) << (segment - 1);
+
+	return a & 0x80 ? t : -t;
+}
+
+// Return -1 if format is not supported (linear PCM is not decoded).
+static int
+wave_decoder_init(struct wave_decoder *d, struct sound_info *info)
+{
+	int i;
+
+	d->format = info->format;
+	d->channels = info->channels;
+	if (!d->channels)
+		return -1;
+
+	switch (info->format) {
+	case WAVE_FORMAT_MULAW:
+	case WAVE_FORMAT_ALAW:
+		if (info->bits_per_sample != 8)
+			return -1;
+		for (i = 0; i < 256; i++) {
+			d->table[i] = info->format == WAVE_FORMAT_MULAW ?
+			              mulaw_to_s16(i) : alaw_to_s16(i);
+		}
+		d->in_bytes = d->channels;
+		d->out_frames = 1;
+		return 0;
+	case WAVE_FORMAT_IEEE_FLOAT:
+		if (info->bits_per_sample != 32)
+			return -1;
+		d->in_bytes = 4 * d->channels;
+		d->out_frames = 1;
+		return 0;
+	case WAVE_FORMAT_IMA_ADPCM:
+		// 4 header bytes per channel, then 8 samples per 4 bytes
+		d->in_bytes = info->bytes_per_sample;
+		if (info->bits_per_sample != 4 || d->in_bytes <= 4 * d->channels ||
+		    (d->in_bytes - 4 * d->channels) % (4 * d->channels))
+			return -1;
+		d->out_frames = (d->in_bytes - 4 * d->channels) * 2 / d->channels + 1;
+		return 0;
+	case WAVE_FORMAT_ADPCM:
+		// 7 header bytes per channel (with 2 samples), then 2 samples
+		// per byte
+		d->in_bytes = info->bytes_per_sample;
+		if (info->bits_per_sample != 4 || d->channels > 2 ||
+		    d->in_bytes <= 7 * d->channels)
+			return -1;
+		d->out_frames = (d->in_bytes - 7 * d->channels) * 2 / d->channels + 2;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static void
+decode_g711(struct wave_decoder *d, const uint8_t *in, int16_t *out, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = d->table[in[i]];
+}
+
+// Floats in the file are little-endian
+static void
+decode_float(const uint8_t *in, int16_t *out, int n)
+{
+	uint32_t u;
+	float v;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		memcpy(&u, in + 4 * i, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		u = __builtin_bswap32(u);
+#endif
+		memcpy(&v, &u, 4);
+		v *= 32768.0f;
+		v = v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v;
+		out[i] = (int16_t) v;
+	}
+}
+
+static inline int16_t
+clamp_s16(int v)
+{
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+static const int16_t ima_step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34,
+	37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157,
+	173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598,
+	658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878,
+	2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t ima_index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+// Block: for each channel, predictor (int16) and step index (uint8, plus
+// a reserved byte). Then, for each channel in turn, 4 bytes with 8
+// samples (low nibble first).
+static void
+decode_ima_adpcm(struct wave_decoder *d, const uint8_t *in, int16_t *out)
+{
+	int channels = d->channels, predictor, index, step, diff, nibble;
+	int c, i, j, frame;
+	const uint8_t *data;
+
+	for (c = 0; c < channels; c++) {
+		predictor = (int16_t) (in[4 * c] | in[4 * c + 1] << 8);
+		index = in[4 * c + 2] > 88 ? 88 : in[4 * c + 2];
+		out[c] = predictor;
+
+		data = in + 4 * channels + 4 * c;
+		frame = 1;
+		for (i = 0; frame < d->out_frames; i++) {
+			for (j = 0; j < 8; j++, frame++) {
+				nibble = data[j / 2] >> (j % 2 * 4) & 0x0f;
+
+				step = ima_step_table[index];
+				diff = step >> 3;
+				if (nibble & 1) diff += step >> 2;
+				if (nibble & 2) diff += step >> 1;
+				if (nibble & 4) diff += step;
+				predictor = clamp_s16(nibble & 8 ? predictor - diff
+				                                 : predictor + diff);
+
+				index += ima_index_table[nibble];
+				index = index < 0 ? 0 : index > 88 ? 88 : index;
+
+				out[frame * channels + c] = predictor;
+			}
+			data += 4 * channels;
+		}
+	}
+}
+
+static const int ms_adpcm_coef1[7] = {256, 512, 0, 192, 240, 460, 392};
+static const int ms_adpcm_coef2[7] = {0, -256, 0, 64, 0, -208, -232};
+
+static const int ms_adpcm_adapt[16] = {
+	230, 230, 230, 230, 307, 409, 512, 614,
+	768, 614, 512, 409, 307, 230, 230, 230,
+};
+
+// Block: predictor index (uint8), delta, sample 1 and sample 2 (int16),
+// each for all channels. Samples 2 and 1 are the first two frames. Then
+// nibbles (high nibble first) alternate between channels.
+//
+// The coefficients used are the standard ones, which are those of every
+// encoder in practice (they are also written in the format chunk).
+static void
+decode_ms_adpcm(struct wave_decoder *d, const uint8_t *in, int16_t *out)
+{
+	int channels = d->channels, coef1[2], coef2[2], delta[2], s1[2], s2[2];
+	int c, i, nibble, predictor, n = (d->out_frames - 2) * channels;
+	const uint8_t *p = in;
+
+	for (c = 0; c < channels; c++, p++) {
+		coef1[c] = ms_adpcm_coef1[*p > 6 ? 0 : *p];
+		coef2[c] = ms_adpcm_coef2[*p > 6 ? 0 : *p];
+	}
+	for (c = 0; c < channels; c++, p += 2)
+		delta[c] = (int16_t) (p[0] | p[1] << 8);
+	for (c = 0; c < channels; c++, p += 2)
+		s1[c] = (int16_t) (p[0] | p[1] << 8);
+	for (c = 0; c < channels; c++, p += 2)
+		s2[c] = (int16_t) (p[0] | p[1] << 8);
+
+	for (c = 0; c < channels; c++) {
+		out[c] = s2[c];
+		out[channels + c] = s1[c];
+	}
+	out += 2 * channels;
+
+	for (i = 0; i < n; i++) {
+		c = i % channels;
+		nibble = i % 2 ? p[i / 2] & 0x0f : p[i / 2] >> 4;
+
+		predictor = (s1[c] * coef1[c] + s2[c] * coef2[c]) >> 8;
+		predictor += (nibble & 8 ? nibble - 16 : nibble) * delta[c];
+		s2[c] = s1[c];
+		s1[c] = clamp_s16(predictor);
+		out[i] = s1[c];
+
+		delta[c] = ms_adpcm_adapt[nibble] * delta[c] >> 8;
+		if (delta[c] < 16)
+			delta[c] = 16;
+	}
+}
+
+// Decode `units` units from `in` to `out`. Return frames decoded.
+static int
+wave_decode(struct wave_decoder *d, const void *in, int units, int16_t *out)
+{
+	const uint8_t *p = in;
+	int i;
+
+	switch (d->format) {
+	case WAVE_FORMAT_MULAW:
+	case WAVE_FORMAT_ALAW:
+		decode_g711(d, p, out, units * d->channels);
+		break;
+	case WAVE_FORMAT_IEEE_FLOAT:
+		decode_float(p, out, units * d->channels);
+		break;
+	case WAVE_FORMAT_IMA_ADPCM:
+		for (i = 0; i < units; i++) {
+			decode_ima_adpcm(d, p + i * d->in_bytes,
+			                 out + i * d->out_frames * d->channels);
+		}
+		break;
+	case WAVE_FORMAT_ADPCM:
+		for (i = 0; i < units; i++) {
+			decode_ms_adpcm(d, p + i * d->in_bytes,
+			                out + i * d->out_frames * d->channels);
+		}
+		break;
+	}
+
+	return units * d->out_frames;
+}
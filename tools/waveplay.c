@@ -23,30 +23,45 @@
 // +-------------+  Data chunk
 // |sound data   | /
 // +-------------+
-
-#include <fcntl.h>    // open()
+//
+// Files are played one after another without gaps. While a file plays,
+// the next one is opened, its header is parsed and the kernel is asked
+// to read ahead its first data (posix_fadvise()). If its sound
+// parameters are the same, its data follows the data of the current file
+// in the PCM buffer: no drain, no prepare. Otherwise, the buffer is
+// drained and the device is set up again on the same file descriptor.
+
+#include <errno.h>    // errno
+#include <fcntl.h>    // open(), posix_fadvise()
 #include <signal.h>   // signal()
 #include <stdio.h>    // perror()
-#include <stdlib.h>   // malloc()
 #include <string.h>   // strcmp()
-#include <sys/stat.h> // open()
+#include <sys/stat.h> // open(), stat()
 #include <unistd.h>   // read()
 
-#include "pcm.h"
+#include "nanoalsa.h"
 #include "riff.h"
 #include "riff_wave.h"
+#include "tune.h"
+#include "wave_decode.h"
 
 static volatile sig_atomic_t        keep_running = 1;
 static void on_sigint(int signum) { keep_running = 0; }
 
 // Put sound parameters in `cfg`, seek to the sound data
 // and return its length.
+//
+// Linear PCM is played as is. Other formats are decoded by `decoder`
+// (see wave_decode.h), and `decoder->format` is set to
+// WAVE_FORMAT_PCM otherwise. WAVE_FORMAT_EXTENSIBLE files are taken by
+// their subformat.
 static int
-wave_setup(int fd, struct pcm_hw_params *cfg)
+wave_setup(int fd, pcm_params_t *cfg, struct wave_decoder *decoder)
 {
 	struct riff_header riff;
 	struct sound_info info;
 	int length;
+	uint32_t size;
 
 	if (riff_get_header(fd, &riff) == -1)
 		return -1;
@@ -58,14 +73,26 @@ wave_setup(int fd, struct pcm_hw_params *cfg)
 	// returns its size
 
 	// go to the start of information chunk
-	if (riff_seek(fd, CHUNK_INFO) < sizeof(info))
+	size = riff_seek(fd, CHUNK_INFO);
+	if (size < sizeof(info))
 		return -1;
 
-	// read information chunk
-	if (read(fd, &info, sizeof(info)) != sizeof(info))
+	// read information chunk (and the extension, which may tell the
+	// format)
+	if (read(fd, &info, sizeof(info)) != sizeof(info) ||
+	    wave_read_extension(fd, &info, size) == -1)
 		return -1;
 
-	pcm_set(cfg, PCM_SAMPLE_BITS, info.bits_per_sample);
+	if (info.format == WAVE_FORMAT_PCM) {
+		decoder->format = WAVE_FORMAT_PCM;
+		pcm_set(cfg, PCM_SAMPLE_BITS, info.bits_per_sample);
+	} else if (wave_decoder_init(decoder, &info) == 0) {
+		pcm_set(cfg, PCM_FORMAT, WAVE_DECODE_FORMAT);
+		pcm_set(cfg, PCM_SAMPLE_BITS, 16);
+	} else {
+		fprintf(stderr, "Unsupported wave format 0x%04x\n", info.format);
+		return -1;
+	}
 	pcm_set(cfg, PCM_RATE,        info.rate);
 	pcm_set(cfg, PCM_CHANNELS,    info.channels);
 
@@ -77,67 +104,252 @@ wave_setup(int fd, struct pcm_hw_params *cfg)
 	return length;
 }
 
+// bytes of data to read ahead when opening a file
+#define PREFETCH_BYTES (1 << 20)
+
+struct item {
+	char *file;
+	int fd;
+	long length; // bytes of sound data
+	pcm_params_t cfg;
+	struct wave_decoder decoder;
+};
+
+// Open file and parse its header. The kernel reads ahead its data in
+// background.
 static int
-waveplay(char *device, char *file)
+item_open(struct item *item, char *file)
 {
-	int file_fd, sound_fd;
-	struct pcm_hw_params cfg;
-	void *buffer;
+	item->file = file;
+	item->fd = open(file, O_RDONLY);
+	if (item->fd == -1) {
+		perror(file);
+		return -1;
+	}
 
-	int period_bytes;
+	pcm_params_init(&item->cfg);
+	pcm_set(&item->cfg, PCM_ACCESS, PCM_ACCESS_RW);
+	item->length = wave_setup(item->fd, &item->cfg, &item->decoder);
+	if (item->length == -1) {
+		fprintf(stderr, "%s: Invalid riff/wave file\n", file);
+		close(item->fd);
+		return -1;
+	}
 
-	pcm_hw_params_init(&cfg);
-	pcm_set(&cfg, PCM_PERIOD_SIZE, 4096);
-	pcm_set(&cfg, PCM_ACCESS, PCM_ACCESS_RW);
+	posix_fadvise(item->fd, lseek(item->fd, 0, SEEK_CUR), PREFETCH_BYTES,
+	              POSIX_FADV_WILLNEED);
 
-	// Open file
-	file_fd = open(file, O_RDONLY);
-	if (file_fd == -1) {
-		perror(file);
+	return 0;
+}
+
+// Open the first valid file from files[i], return its index or -1
+static int
+item_open_next(struct item *item, char **files, int i, int n)
+{
+	for (; i < n; i++) {
+		if (item_open(item, files[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+// Whether the device set up with `cfg` plays `item` as is
+static int
+item_fits(struct item *item, pcm_params_t *cfg)
+{
+	pcm_param_t params[] = {PCM_RATE, PCM_CHANNELS, PCM_SAMPLE_BITS};
+	unsigned int min, max;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		pcm_get_range(&item->cfg, params[i], &min, &max);
+		if (min != max || min != pcm_get_min(cfg, params[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+struct player {
+	int fd;
+	char *device;
+	pcm_params_t cfg;
+	pcm_pool_t pool;
+	void *buffer, *input;
+	int period_size, frame_bytes, buffer_bytes;
+};
+
+// Set up the device for `item`. If it is already set up, it is drained
+// and reconfigured in place.
+static int
+player_setup(struct player *p, struct item *item, int again)
+{
+	pcm_params_t from = p->cfg;
+
+	if (again) {
+		pcm_drain(p->fd);
+		pcm_pool_put(&p->pool, p->input);
+		pcm_pool_put(&p->pool, p->buffer);
+		pcm_pool_destroy(&p->pool);
+	}
+
+	p->cfg = item->cfg;
+
+	// Sizes found by pcmtune for this device, if any
+	if (tune_apply(p->fd, p->device, &p->cfg) == -1)
+		pcm_set(&p->cfg, PCM_PERIOD_SIZE, 4096);
+
+	// Set PCM device parameters
+	if ((again ? pcm_reconfigure(p->fd, &from, &p->cfg, NULL) :
+	             pcm_params_setup(p->fd, &p->cfg)) == -1) {
+		perror("Error while setting PCM hardware parameters");
 		return -1;
 	}
 
-	// Get wave file parameters and seek to data
-	if (wave_setup(file_fd, &cfg) == -1) {
-		perror("Invalid riff/wave file");
+	// Page aligned, locked buffers (lock is best effort): one for output
+	// and one for input to the decoder. They have the size of the whole
+	// PCM buffer, as a decoder unit (ADPCM block) may be larger than one
+	// period.
+	p->period_size  = pcm_get(&p->cfg, PCM_PERIOD_SIZE, 0);
+	p->frame_bytes  = pcm_get(&p->cfg, PCM_FRAME_BITS, 0) / 8;
+	p->buffer_bytes = pcm_get(&p->cfg, PCM_BUFFER_BYTES, 0);
+	if (pcm_pool_init(&p->pool, &p->cfg, PCM_BUFFER_BYTES, 2,
+	                  PCM_POOL_PAGE_ALIGN | PCM_POOL_LOCK) == -1 &&
+	    pcm_pool_init(&p->pool, &p->cfg, PCM_BUFFER_BYTES, 2,
+	                  PCM_POOL_PAGE_ALIGN) == -1) {
+		perror("Error while allocating period buffer");
 		return -1;
 	}
+	p->buffer = pcm_pool_get(&p->pool);
+	p->input  = pcm_pool_get(&p->pool);
+
+	return 0;
+}
+
+// On underrun the state becomes XRUN and write error is
+// EPIPE. The stream is prepared and written again.
+static int
+player_write(struct player *p, int frames)
+{
+	if (pcm_write(p->fd, p->buffer, frames) != -1)
+		return 0;
+	if (errno != EPIPE || pcm_prepare(p->fd) == -1)
+		return -1;
+
+	return pcm_write(p->fd, p->buffer, frames) == -1 ? -1 : 0;
+}
+
+// Play sound data of `item` until its end
+static int
+player_play(struct player *p, struct item *item)
+{
+	struct wave_decoder *decoder = &item->decoder;
+	long remaining = item->length;
+	int bytes, units, frames;
+
+	if (decoder->format == WAVE_FORMAT_PCM) {
+		while (keep_running && remaining > 0) {
+			bytes = p->period_size * p->frame_bytes;
+			if (bytes > remaining)
+				bytes = remaining;
+			bytes = read(item->fd, p->buffer, bytes);
+			if (bytes <= 0)
+				break;
+			remaining -= bytes;
+
+			// a partial frame at the end is ignored
+			if (player_write(p, bytes / p->frame_bytes) == -1)
+				return -1;
+		}
+		return 0;
+	}
+
+	// units that make about one period
+	units = p->period_size / decoder->out_frames;
+	if (!units)
+		units = 1;
+	if (units * decoder->in_bytes > p->buffer_bytes ||
+	    units * decoder->out_frames * 2 * decoder->channels > p->buffer_bytes) {
+		fputs("Wave block larger than PCM buffer\n", stderr);
+		return -1;
+	}
+
+	// a partial unit at the end is ignored
+	while (keep_running && remaining >= decoder->in_bytes) {
+		bytes = units * decoder->in_bytes;
+		if (bytes > remaining)
+			bytes = remaining;
+		bytes = read(item->fd, p->input, bytes);
+		if (bytes <= 0)
+			break;
+		remaining -= bytes;
+
+		frames = wave_decode(decoder, p->input, bytes / decoder->in_bytes,
+		                     p->buffer);
+		if (player_write(p, frames) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+waveplay(char *device, char **files, int n)
+{
+	struct player player = {.device = device};
+	struct item items[2], *current = &items[0], *next = &items[1], *tmp;
+	int i;
+
+	// Open first file
+	i = item_open_next(current, files, 0, n);
+	if (i == -1)
+		return -1;
 
 	// Open PCM device
-	sound_fd = open(device, O_RDWR);
-	if (sound_fd == -1) {
+	player.fd = open(device, O_RDWR);
+	if (player.fd == -1) {
 		perror(device);
 		return -1;
 	}
 
-	// Set PCM device parameters
-	if (pcm_hw_params_setup(sound_fd, &cfg) == -1) {
-		perror("Error while setting PCM hardware parameters");
+	if (player_setup(&player, current, 0) == -1)
 		return -1;
-	}
 
-	period_bytes  = pcm_get(&cfg, PCM_PERIOD_BYTES, 0);
-	buffer = malloc(period_bytes);
+	while (keep_running) {
+		// Prepare the next file while this one plays
+		i = item_open_next(next, files, i + 1, n);
 
-	// do playback
-	while (keep_running && read(file_fd, buffer, period_bytes) > 0)
-		write(sound_fd, buffer, period_bytes);
+		// do playback
+		if (player_play(&player, current) == -1)
+			perror(current->file);
+		close(current->fd);
 
-	// drain before exit
-	pcm_drain(sound_fd);
+		if (i == -1)
+			break;
 
-	// On underrun the state becomes SETUP and write
-	// error is EPIPE.
+		if (!item_fits(next, &player.cfg) &&
+		    player_setup(&player, next, 1) == -1)
+			return -1;
 
-	free(buffer);
-	close(sound_fd);
-	close(file_fd);
+		tmp = current;
+		current = next;
+		next = tmp;
+	}
+
+	// drain before exit
+	pcm_drain(player.fd);
+
+	pcm_pool_put(&player.pool, player.input);
+	pcm_pool_put(&player.pool, player.buffer);
+	pcm_pool_destroy(&player.pool);
+	close(player.fd);
 
 	return 0;
 }
 
 static const char *usage =
-"usage: cmd [pcm_device_file] <wav_file>\n"
+"usage: cmd [pcm_device_file] <wav_file>...\n"
 "Default PCM device: /dev/snd/pcmC0D0p (PCM Card 0, Device 0, playback)\n"
 "Since it's a playback program, only playback devices will work :-)\n";
 
@@ -145,19 +357,18 @@ int
 main(int argc, char **argv)
 {
 	char *device = "/dev/snd/pcmC0D0p";
-	char *file;
+	struct stat st;
 
 	signal(SIGINT, on_sigint);
 
-	argv++;
-	if (argc > 2)
-		device  = *argv, argv++, argc--;
-	if (argc < 2) {
+	argv++, argc--;
+	// the first argument is the device if it is one
+	if (argc > 1 && stat(*argv, &st) == 0 && S_ISCHR(st.st_mode))
+		device = *argv, argv++, argc--;
+	if (argc < 1) {
 		fputs(usage, stderr);
 		return 1;
 	}
 
-	file = *argv;
-
-	return waveplay(device, file) == -1;
+	return waveplay(device, argv, argc) == -1;
 }